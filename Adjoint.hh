@@ -0,0 +1,227 @@
+/*******
+* Adjoint.hh
+*   Adjoint Monte Carlo of the energy a diffuse source outside a slab stack deposits in its last layer.
+*
+* Dependencies:
+*   CalcAtten.hh: Layer and ParallelFor()
+*   Scatter.hh: ComptonEnergy(), KleinNishina(), KleinNishinaTotal(), GaussLegendre() and ELECTRON_MASS_KEV
+*   Transport.hh: SlabProblem, RotateDirection(), Histogram and TRANSPORT_BATCH
+*
+* Problem:
+*   the physics of Transport: slabs from z = 0, free-electron Compton scattering, every other interaction absorbs,
+*   photons scattered below the cutoff are absorbed; the last layer is the detector (e.g. the Ge crystal)
+*   the source is an isotropic flux of Gamma-energy photons outside the z = 0 face, normalised to one photon
+*   entering per unit area; the response is the energy deposited in the detector per entering photon, which is
+*   what Transport tallies for the last layer with Beam: diffuse
+*
+* Method:
+*   adjoint particles start in the detector from the adjoint source mu_t(E) D(E), where D(E) is the mean energy a
+*   collision at E leaves in the detector, and fly backwards with the same coefficients as Transport
+*   at each collision they move up in energy by a reversed Compton scatter: cos(theta) is sampled uniformly over
+*   the range that keeps the new energy at or below the source energy, and the weight carries the ratio of the
+*   adjoint kernel to that choice
+*   the source is a line, so no adjoint particle ever reaches exactly the Gamma energy; instead every collision
+*   scores the expected contribution of scattering up to exactly that energy and leaving through z = 0 without
+*   another collision (a next-event estimator in energy), and the uncollided part is integrated deterministically
+*   a weight window follows each particle's expected score: the target weight falls as exp(-tau) with the
+*   optical depth at E0 still between it and z = 0, so particles working their way out through a thick shield
+*   are split and those heading back into it are rouletted
+*   because every collision anywhere in the stack scores, the estimate does not rely on forward photons finding
+*   the detector, which is where the forward calculation spends nearly all its histories
+*
+* Ref:
+*   I. Lux and L. Koblinger, "Monte Carlo Particle Transport Methods: Neutron and Photon Calculations",
+*   CRC Press (1991), chapter 6
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+const double ADJOINT_WINDOW = 4; // weights within this factor of the target are left alone
+const int ADJOINT_MAX_SPLIT = 8;
+const int ADJOINT_QUADRATURE = 32;
+
+struct AdjointConfig
+{
+  double E0; // source energy (keV)
+  double Ecut; // cutoff energy (keV)
+  long histories;
+  unsigned long seed;
+};
+
+struct AdjointResult
+{
+  double uncollided; // keV deposited in the detector per entering photon, photons entering uncollided
+  double scattered;
+  double relError; // of scattered
+};
+
+struct AdjointParticle
+{
+  double E, z, u, w;
+  int layer;
+  double target; // weight-window target times exp(-tau to the face)
+};
+
+struct AdjointProblem
+{
+  const SlabProblem& p;
+  double E0, Ecut;
+  int det; // detector layer
+  vector<double> tau0; // optical depth at E0 from z = 0 to each boundary, along z
+  vector<double> mu0; // per layer at E0 (1/cm)
+  vector<double> xq, wq; // Gauss-Legendre nodes and weights on [-1, 1]
+
+  AdjointProblem(const SlabProblem& problem, double E, double cut) : p(problem), E0(E), Ecut(cut), det(problem.ne.size() - 1)
+  {
+    mu0.resize(p.ne.size());
+    p.lookup.Eval(E0, &mu0[0]);
+    tau0.push_back(0.0);
+    for (size_t i = 0; i < mu0.size(); i++) tau0.push_back(tau0.back() + mu0[i] * (p.zb[i+1] - p.zb[i]));
+    GaussLegendre(ADJOINT_QUADRATURE, xq, wq);
+  }
+
+  double Deposit(double E, double mut) const
+  {
+    /*******
+    * Mean energy (keV) left in the detector by a collision at E, given the detector's mu_t at E
+    *******/
+
+    double cCut = 1 - ELECTRON_MASS_KEV * (1/Ecut - 1/E); // scatters below this cosine fall under the cutoff
+    if (cCut >= 1) return E;
+    double lo = max(-1.0, cCut), half = 0.5 * (1 - lo), kept = 0.0;
+    for (int q = 0; q < ADJOINT_QUADRATURE; q++)
+    {
+      double c = lo + half * (1 + xq[q]);
+      kept += wq[q] * half * 2 * M_PI * KleinNishina(E, c) * ComptonEnergy(E, c);
+    }
+    return E - p.ne[det] * kept / mut;
+  }
+
+  double TauToFace(double z) const
+  {
+    int l = p.LayerAt(z);
+    return tau0[l] + mu0[l] * (z - p.zb[l]);
+  }
+
+  double Uncollided() const
+  {
+    /*******
+    * 2 D(E0) * integral over u of u exp(-tau_front/u) (1 - exp(-tau_det/u)), by Gauss-Legendre on (0, 1)
+    *******/
+
+    double sum = 0.0;
+    for (int q = 0; q < ADJOINT_QUADRATURE; q++)
+    {
+      double u = 0.5 * (1 + xq[q]);
+      sum += 0.5 * wq[q] * u * exp(-tau0[det] / u) * (1 - exp(-(tau0[det+1] - tau0[det]) / u));
+    }
+    return 2 * Deposit(E0, mu0[det]) * sum;
+  }
+};
+
+void RunAdjointBatch(const AdjointProblem& a, long n, mt19937_64& rng, double& score)
+{
+  /*******
+  * Follow n adjoint particles from the detector and add their next-event scores (keV per entering photon) to score
+  *******/
+
+  uniform_real_distribution<double> unif(0.0, 1.0);
+  const SlabProblem& p = a.p;
+  int nLayers = p.ne.size();
+  double lnRange = log(a.E0 / a.Ecut), thick = p.zb[a.det+1] - p.zb[a.det];
+  vector<AdjointParticle> split; // copies waiting to be followed
+  for (long h = 0; h < n; h++)
+  {
+    // start from the adjoint source: ln(E) and z uniform over the detector, isotropic direction
+    AdjointParticle s;
+    s.E = a.Ecut * exp(lnRange * unif(rng));
+    s.z = p.zb[a.det] + thick * unif(rng);
+    s.u = 2 * unif(rng) - 1;
+    s.layer = a.det;
+    double mut0 = p.lookup.EvalOne(s.E, s.layer);
+    s.w = 4 * M_PI * thick * s.E * lnRange * mut0 * a.Deposit(s.E, mut0);
+    s.target = s.w * exp(-a.TauToFace(s.z));
+    split.push_back(s);
+
+    while (!split.empty())
+    {
+      AdjointParticle q = split.back();
+      split.pop_back();
+      double E = q.E, z = q.z, u = q.u, w = q.w;
+      int layer = q.layer;
+      while (true)
+      {
+        // flight, surface tracking as in Transport
+        double mut = p.lookup.EvalOne(E, layer);
+        double dist = -log(1 - unif(rng)) / mut;
+        double toBoundary = u > 0 ? (p.zb[layer+1] - z) / u : (u < 0 ? (p.zb[layer] - z) / u : 1e300);
+        if (dist >= toBoundary)
+        {
+          z = u > 0 ? p.zb[layer+1] : p.zb[layer];
+          layer += u > 0 ? 1 : -1;
+          if (layer == nLayers || layer < 0) break;
+          continue;
+        }
+        z += dist * u;
+
+        // next event: scatter up to exactly E0 and leave through z = 0
+        double ne = p.ne[layer];
+        double c0 = 1 - ELECTRON_MASS_KEV * (1/E - 1/a.E0);
+        if (c0 >= -1)
+        {
+          double uOut = RotateDirection(u, c0, rng); // adjoint direction, i.e. minus the photon's
+          if (uOut < 0) score += w * ne * KleinNishina(a.E0, c0) * ELECTRON_MASS_KEV / (E*E) / mut * 2 * exp(-a.TauToFace(z) / -uOut);
+        }
+
+        // reversed Compton scatter to a higher energy, cos(theta) uniform on [cMin, 1]
+        if (c0 >= 1 - 1e-12) break;
+        double cMin = max(-1.0, c0), c = cMin + (1 - cMin) * unif(rng);
+        double E1 = 1 / (1/E - (1 - c) / ELECTRON_MASS_KEV);
+        w *= ne * KleinNishina(E1, c) * (E1/E) * (E1/E) * 2 * M_PI * (1 - cMin) / mut;
+        u = RotateDirection(u, c, rng);
+        E = E1;
+
+        // weight window
+        double target = q.target * exp(a.TauToFace(z));
+        if (w < target / ADJOINT_WINDOW)
+        {
+          if (unif(rng) * target >= w) break;
+          w = target;
+        }
+        else if (w > target * ADJOINT_WINDOW)
+        {
+          int copies = min(ADJOINT_MAX_SPLIT, (int)(w / target));
+          w /= copies;
+          for (int k = 1; k < copies; k++) split.push_back(AdjointParticle{E, z, u, w, layer, q.target});
+        }
+      }
+    }
+  }
+}
+
+AdjointResult RunAdjoint(const vector<Layer>& stack, const AdjointConfig& cfg, double& seconds)
+{
+  /*******
+  * Run cfg.histories adjoint particles in batches as Transport does; seconds receives the wall time
+  *******/
+
+  SlabProblem p(stack);
+  AdjointProblem a(p, cfg.E0, cfg.Ecut);
+  long nBatches = (cfg.histories + TRANSPORT_BATCH - 1) / TRANSPORT_BATCH;
+  vector<double> scores(nBatches, 0.0);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  ParallelFor(nBatches, [&](int b)
+  {
+    long n = min(TRANSPORT_BATCH, cfg.histories - b * TRANSPORT_BATCH);
+    mt19937_64 rng(cfg.seed * 1000003ULL + b);
+    RunAdjointBatch(a, n, rng, scores[b]);
+  });
+  seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  Histogram total(1, 0, 1), batch(1, 0, 1);
+  for (long b = 0; b < nBatches; b++) {batch.sum[0] = scores[b]; total.Merge(batch);}
+  AdjointResult res = {a.Uncollided(), total.sum[0] / cfg.histories, total.RelError(0)};
+  return res;
+}
@@ -0,0 +1,169 @@
+/*******
+* Batch.hh
+*   Transmission of many different stacks at a few energies, evaluated across stacks in SIMD lanes.
+*
+* Dependencies:
+*   CalcAtten.hh: LoadMaterial(), MuRho(), SplitArgs() and ParallelFor()
+*   Shard.hh: RunSharded(), ShardSize(), PutDoubles(), GetDoubles() and numWorkers
+*
+* Layout:
+*   stacks are grouped into blocks of BATCH_LANES; within a block each layer is one LayerLanes holding the
+*   BATCH_LANES material indices and thicknesses (array of structs of arrays), and every stack of the block is
+*   padded to the block's depth with zero-thickness layers, so the inner loop runs over lanes with no branches
+*   at each energy the coefficients of all materials are looked up once, and the kernel only gathers and sums
+*   with Workers on, runs of consecutive blocks are sharded across worker processes
+*
+* Stack file:
+*   one stack per line, layers separated by ';', e.g. "Pb,3;Cu,2"; an empty line is an empty stack
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+const int BATCH_LANES = 16;
+
+struct LayerLanes
+{
+  int mats[BATCH_LANES]; // material index of this layer in each lane's stack
+  double ts[BATCH_LANES]; // thickness (cm), 0 for padding
+};
+
+struct StackBatch
+{
+  vector<string> materials; // distinct absorbers, indexed by LayerLanes::mats
+  int nStacks;
+  vector<int> blockStart; // first layer of each block in layers
+  vector<int> blockDepth;
+  vector<LayerLanes> layers;
+};
+
+StackBatch PackStacks(const vector<vector<Layer> >& stacks)
+{
+  /*******
+  * Pack stacks into the blocked, padded layout described in the header of this file
+  *******/
+
+  StackBatch b;
+  b.nStacks = stacks.size();
+  map<string, int> index;
+  for (size_t s = 0; s < stacks.size(); s++)
+    for (size_t l = 0; l < stacks[s].size(); l++)
+      if (index.find(stacks[s][l].absorber) == index.end())
+      {
+        index[stacks[s][l].absorber] = b.materials.size();
+        b.materials.push_back(stacks[s][l].absorber);
+      }
+  if (b.materials.empty()) b.materials.push_back("Air"); // padding needs some material index
+
+  for (int s0 = 0; s0 < b.nStacks; s0 += BATCH_LANES)
+  {
+    int depth = 0;
+    for (int s = s0; s < min(b.nStacks, s0 + BATCH_LANES); s++) depth = max(depth, (int)stacks[s].size());
+    b.blockStart.push_back(b.layers.size());
+    b.blockDepth.push_back(depth);
+    for (int l = 0; l < depth; l++)
+    {
+      LayerLanes ll;
+      for (int lane = 0; lane < BATCH_LANES; lane++)
+      {
+        int s = s0 + lane;
+        bool real = s < b.nStacks && l < (int)stacks[s].size();
+        ll.mats[lane] = real ? index[stacks[s][l].absorber] : 0;
+        ll.ts[lane] = real ? stacks[s][l].thickness : 0.0;
+      }
+      b.layers.push_back(ll);
+    }
+  }
+  return b;
+}
+
+void BatchKernel(const LayerLanes* layers, int depth, const double* mu, double* T)
+{
+  /*******
+  * Transmission of one block of BATCH_LANES stacks, given mu (1/cm) of every material at one energy
+  *******/
+
+  double tau[BATCH_LANES] = {0};
+  for (int l = 0; l < depth; l++)
+  {
+    const LayerLanes& ll = layers[l];
+#pragma GCC ivdep
+    for (int lane = 0; lane < BATCH_LANES; lane++) tau[lane] += mu[ll.mats[lane]] * ll.ts[lane];
+  }
+  for (int lane = 0; lane < BATCH_LANES; lane++) T[lane] = exp(-tau[lane]);
+}
+
+vector<double> BatchTransmit(const StackBatch& b, const vector<double>& energies)
+{
+  /*******
+  * Return T[stack * nEnergies + e] for every stack of b at every energy (keV), blocks in parallel
+  *******/
+
+  int nE = energies.size(), nMat = b.materials.size(), nBlocks = b.blockStart.size();
+  vector<double> mu(nE * nMat);
+  for (int m = 0; m < nMat; m++)
+  {
+    const Material& mat = LoadMaterial(b.materials[m]);
+    for (int e = 0; e < nE; e++) mu[e*nMat + m] = MuRho(mat, energies[e]);
+  }
+  workCounters.energies += (long)b.nStacks * nE;
+
+  vector<double> T((size_t)nBlocks * BATCH_LANES * nE);
+  auto runBlock = [&](int blk)
+  {
+    double out[BATCH_LANES];
+    for (int e = 0; e < nE; e++)
+    {
+      BatchKernel(&b.layers[b.blockStart[blk]], b.blockDepth[blk], &mu[e*nMat], out);
+      for (int lane = 0; lane < BATCH_LANES; lane++) T[((size_t)blk * BATCH_LANES + lane) * nE + e] = out[lane];
+    }
+  };
+  if (numWorkers > 0)
+  {
+    // shards of consecutive blocks; a worker sends back its slice of T
+    size_t perBlock = (size_t)BATCH_LANES * nE;
+    long size = ShardSize(nBlocks), nShards = (nBlocks + size - 1) / size;
+    RunSharded(nShards, [&](long s)
+    {
+      long blk0 = s * size, n = min(size, nBlocks - blk0);
+      ParallelFor(n, [&](int k) {runBlock(blk0 + k);});
+      string out;
+      PutDoubles(out, &T[blk0 * perBlock], n * perBlock);
+      return out;
+    },
+    [&](long s, const string& result)
+    {
+      const char* in = result.data();
+      GetDoubles(in, &T[s * size * perBlock], result.size() / sizeof(double));
+    });
+  }
+  else ParallelFor(nBlocks, runBlock);
+  T.resize((size_t)b.nStacks * nE); // drop the padding lanes of the last block
+  return T;
+}
+
+vector<vector<Layer> > ReadStacks(string fileName)
+{
+  /*******
+  * Read a stack file; see the header of this file for its format
+  *******/
+
+  ifstream in(fileName);
+  if (!in.is_open()) {cout << "Error: Stack file not open" << endl; exit(EXIT_FAILURE);}
+  vector<vector<Layer> > stacks;
+  string line;
+  while (getline(in, line))
+  {
+    vector<Layer> stack;
+    vector<string> layers = SplitArgs(line, ';');
+    for (size_t l = 0; l < layers.size(); l++)
+    {
+      if (layers[l].empty()) continue;
+      vector<string> f = SplitArgs(layers[l]);
+      if (f.size() != 2) {cout << "Error: Bad layer in stack file: " << layers[l] << endl; exit(EXIT_FAILURE);}
+      stack.push_back(Layer{f[0], stod(f[1])});
+    }
+    stacks.push_back(stack);
+  }
+  return stacks;
+}
@@ -7,8 +7,76 @@
 *   macro.txt: a macro file  specifying the radiation type and energy, and the layers of shielding
 *
 * Usage:
-*   compile: g++ -g -Wall -oCalcAtten CalcAtten.cc
+*   compile: g++ -g -O2 -Wall -pthread -oCalcAtten CalcAtten.cc
 *   execute: ./CalcAtten macro.txt
+*   table:   ./CalcAtten macro.txt --table rows.csv results.txt   run a macro with $name parameters once per row
+*            of a CSV or binary parameter table (see Table.hh)
+*   plan:    ./CalcAtten macro.txt [--table rows.csv results.txt] --plan   report the work, kernel paths, time and
+*            memory of a macro or table job without running it (see Plan.hh)
+*   zygote:  ./CalcAtten --zygote /tmp/calcatten.sock [warm.snap] &   preload every material (or restore a
+*            snapshot) and serve runs; with CALCATTEN_ZYGOTE=/tmp/calcatten.sock set, each ./CalcAtten call is a
+*            fork of it (see Zygote.hh); its output logs the cost of every request, and
+*            ./CalcAtten --slow-requests prints the traces it kept of requests slower than CALCATTEN_SLOW seconds
+*   test:    Tests/run.sh [--update]   run the macros in Tests/ and compare their output with Tests/ref/
+*
+* Macro commands:
+*   Gamma(keV): E                          set the gamma-ray energy
+*   Shield(type,cm): Pb,3.0                add a layer and print the remaining intensity; layers are also kept
+*                                          as the stack used by the geometry-based modes, innermost first
+*   Threads: n                             worker threads for parallel modes (default: all hardware threads)
+*   Workers: n                             shard StackBatch, Sweep and Transport across n worker processes,
+*                                          each using Threads threads (default 0: run in this process)
+*   Target(keV): E                         add a target line for Pareto (default: the Gamma energy)
+*   Cavity(shape,cm): cyl,r,h | box,x,y,z  inner cavity of a nested-shell castle, centred on the origin
+*   ParetoMaterials: Pb,Cu,Poly            candidate absorbers for Pareto
+*   Pareto(layers,cm,pop,gens): 3,20,100,500   NSGA-II search over material, order and thickness
+*   IdentifyMaterials: Pb,Cu,Poly          candidate absorbers for Identify (default: every material in Data/)
+*   Identify(file,out,keV...): pix.csv,id.txt,80,140   best material and thickness for each row of measured
+*                                          transmissions at these energies (CSV or binary table, as for --table)
+*   HypercubeAxis(type,cm): Pb,20          add a layer, 0 to 20 cm, to the hypercube family
+*   HypercubeBuild(file,keV,keV,nE,nt): cube.bin,50,3000,256,21   tabulate ln(T) for the family
+*   HypercubeOpen(file): cube.bin          memory-map a tabulated family
+*   HypercubeQuery(keV,cm...): 662,5,2     interpolate T, with its estimated error and the exact value
+*   Import(manifest,db): list.txt,mat.db   parse external cross-section tables into a packed material database
+*   MaterialDB(file): mat.db               use the materials of a packed database ahead of the Data/ files
+*   PackTables(numa): on|off               pack every loaded material onto one union energy grid on huge pages,
+*                                          with one pinned copy per NUMA node if on
+*   Snapshot(file): warm.snap              save the loaded materials and packed tables (see Snapshot.hh)
+*   Restore(file): warm.snap               replace them with a snapshot's, mapped in without recomputation
+*   Source(cm,cm,cm): 0,0,0                position of the point source (default: the origin)
+*   Activity(Bq): 3.7e10                   photons/s emitted at the Gamma energy (default: 1)
+*   DoseRegion(cm): x0,x1,y0,y1,z0,z1      region for DoseMap
+*   DoseMap(file,n0,depth,tol): dose.txt,4,5,0.1   adaptive octree map of the air kerma rate (Gy/h)
+*   SingleScatter(cm,cm,nz,nr): 50,10,16,64   single-Compton-scatter correction for the stack as slabs,
+*                                          point source and detector this far before/behind it
+*   SN(order,groups,keV): 16,40,20         multigroup S_N transport of a normal beam through the stack as slabs,
+*                                          groups from the Gamma energy down to this cutoff
+*   SNWeight: midpoint|lethargy|w.txt     SN group totals at the group midpoints (default), or collapsed with a
+*                                          1/E or tabulated ("keV weight") weight
+*   Collapse(file,groups,keV,keV,weight): mg.txt,40,3000,20,lethargy   group-averaged mu/rho and mu_en/rho of
+*                                          the stack's materials on log-spaced groups, weighted as for SNWeight
+*   StackBatch(file,out,keV...): stacks.txt,T.txt,662,2614.5   transmission of every stack in a file
+*   SweepPlot(file,mode,buckets): Tplot.txt,minmax,2000   also write Sweep results downsampled (minmax or lttb)
+*                                          to this many buckets, edges kept; mode off stops it
+*   Sweep(file,keV,keV,n): T.txt,10,3000,1e7   transmission of the stack at n log-spaced energies plus its
+*                                          absorption edges; file none writes only the SweepPlot curve
+*   SweepAdaptive(file,keV,keV,tol): T.txt,10,3000,1e-3   transmission on a grid refined at edges and wherever
+*                                          log-log interpolation would be off by more than tol (relative)
+*   Unfold(file,out,fwhm,iters): m.txt,src.txt,7,2000   MLEM estimate of the source spectrum from a spectrum
+*                                          ("keV counts") measured behind the stack, detector FWHM in % at 662 keV
+*   Seed: n                                random seed for Transport (default 12345)
+*   TransportMode: history|event           Monte Carlo scheduling for Transport (default event)
+*   Tracking: surface|delta                surface or Woodcock delta tracking for Transport (default surface)
+*   Beam: normal|diffuse                   normal beam or isotropic (cosine-law) incidence for Transport
+*   Tallies(file,bins,batches): t.txt,100,50   write the Transport histograms to this file, rewritten every
+*                                          this many batches of 10000 histories (0: at the end only)
+*   Transport(histories,keV): 1e6,10       analog Monte Carlo of a normal beam through the stack as slabs,
+*                                          photons below the cutoff energy are absorbed
+*   Adjoint(histories,keV): 1e6,10         adjoint Monte Carlo of the energy deposited in the last layer by a
+*                                          diffuse source before the first, photons below the cutoff absorbed
+*   Waypoint(cm,cm,cm,s): x,y,z,t          add a point of a piecewise-linear trajectory
+*   Detector(cm,cm,cm): x,y,z              fixed detector position for a moving source
+*   Trajectory(mode,tol): detector,1e-4    dose along the waypoints as the detector (or the shielded source) moves
 *
 * Ref:
 *   https://physics.nist.gov/PhysRefData/XrayMassCoef/chap2.html
@@ -23,18 +91,94 @@
 
 // include the useful functions defined in the header file
 #include "CalcAtten.hh"
+#include "Geometry.hh"
+#include "Pareto.hh"
+#include "Hypercube.hh"
+#include "Import.hh"
+#include "DoseMap.hh"
+#include "Tables.hh"
+#include "Shard.hh"
+#include "Snapshot.hh"
+#include "Scatter.hh"
+#include "Collapse.hh"
+#include "SN.hh"
+#include "Trajectory.hh"
+#include "Batch.hh"
+#include "Sweep.hh"
+#include "Unfold.hh"
+#include "Table.hh"
+#include "Identify.hh"
+#include "Transport.hh"
+#include "Adjoint.hh"
+#include "Plan.hh"
+#include "Zygote.hh"
 
-// main body of program
-int main(int argc, char* argv[])
+// body of program, run in this process or in a fork of the zygote
+int RunCalcAtten(int argc, char* argv[])
 {
     // read command line arguments
     if (argc < 2) {cout << "Usage: ./CalcAtten <macro>" << endl; exit(EXIT_FAILURE);}
     char* macroFileName = argv[1];
+    if (string(macroFileName) == "--slow-requests") {cout << "Error: --slow-requests needs a zygote (CALCATTEN_ZYGOTE)" << endl; exit(EXIT_FAILURE);}
+
+    // dry run: plan the macro or table job instead of running it
+    if (argc > 2 && string(argv[argc-1]) == "--plan")
+    {
+      OpenSpan(0, "plan");
+      if (argc == 6 && string(argv[2]) == "--table") PlanTable(macroFileName, argv[3]);
+      else if (argc == 3) PlanMacro(macroFileName);
+      else {cout << "Usage: ./CalcAtten <macro> [--table <rows> <results>] --plan" << endl; exit(EXIT_FAILURE);}
+      FreeTables();
+      return 0;
+    }
+
+    // parameter-table execution: compile the macro once and run it for every row
+    if (argc > 2 && string(argv[2]) == "--table")
+    {
+      if (argc != 5) {cout << "Usage: ./CalcAtten <macro> --table <rows> <results>" << endl; exit(EXIT_FAILURE);}
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      OpenSpan(0, "compile macro");
+      CompiledMacro cm = CompileMacro(macroFileName);
+      OpenSpan(0, "read table");
+      ParamTable pt = ReadParamTable(argv[3]);
+      cout << "Running " << cm.steps.size() << " steps with " << cm.params.size() << " parameters for " << pt.nRows << " rows" << endl;
+      OpenSpan(0, "run table");
+      RunTable(cm, pt, argv[4]);
+      CloseSpan();
+      CloseParamTable(pt);
+      FreeTables();
+      cout << "  " << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s" << endl;
+      return 0;
+    }
 
     // prep vars
     double I_init = 1.0;
     double I = I_init;
     double E = 0.0;
+    vector<Layer> stack;
+    Body cavity = ParseCavity("cyl,10,20");
+    double source[3] = {0.0, 0.0, 0.0};
+    double activity = 1.0;
+    double doseRegion[6] = {-100, 100, -100, 100, -100, 100};
+    double detector[3] = {0.0, 0.0, 0.0};
+    vector<Waypoint> waypoints;
+    unsigned long seed = 12345;
+    bool eventBased = true;
+    bool deltaTracking = false;
+    bool diffuseBeam = false;
+    string tallyFile;
+    int tallyBins = 100;
+    long tallyCheckpoint = 0;
+    string sweepPlotFile, sweepPlotMode = "minmax";
+    long sweepBuckets = 2000;
+    ParetoConfig pareto;
+    pareto.seed = 12345;
+    vector<string> identifyMaterials;
+    WeightSpectrum snWeight;
+    bool snCollapse = false; // SN totals collapsed with snWeight, else taken at group midpoints
+    vector<Layer> hypercubeAxes;
+    Hypercube hypercube;
+    hypercube.map = NULL;
 
     // create ifstream for macro file and open the file
     ifstream ifs;
@@ -46,6 +190,7 @@ int main(int argc, char* argv[])
       // prep vars for holding macro lines, and positions and substrings of macro lines
       string line, cmdType, cmdArg, cmdArg0, cmdArg1;
       string::size_type n = string::npos;
+      int lineNo = 0;
 
       // get line from macro
       while (getline(ifs, line))
@@ -55,6 +200,7 @@ int main(int argc, char* argv[])
         if (n == string::npos) {cout << "Error: Unexpected macro format" << endl; exit(EXIT_FAILURE);}
         cmdType = line.substr(0, n); // substr returns [pos, pos+count)
         cmdArg = line.substr(n+1, string::npos);
+        OpenSpan(++lineNo, cmdType); // in a zygote run, time each command
 
         // parse Gamma(keV): command
         if (cmdType == "Gamma(keV):")
@@ -75,15 +221,401 @@ int main(int argc, char* argv[])
           cout << "Calculating intensity following " << cmdArg1 << " cm of " << cmdArg0 << endl;
           double T = Transmit(cmdArg0, cmdArg1, E);
           I = I * T;
+          stack.push_back(Layer{cmdArg0, stod(cmdArg1)});
           cout << "  Transmit frac, this layer: " << T << endl;
           cout << "  Remaining I = " << I << ", I_init = " << I_init << endl;
         }
+
+        // parse Threads: command
+        if (cmdType == "Threads:") numThreads = stoi(cmdArg);
+
+        // parse Workers: command
+        if (cmdType == "Workers:") numWorkers = stoi(cmdArg);
+
+        // parse Target(keV): command
+        if (cmdType == "Target(keV):") pareto.targets.push_back(stod(cmdArg));
+
+        // parse Cavity(shape,cm): command
+        if (cmdType == "Cavity(shape,cm):") cavity = ParseCavity(cmdArg);
+
+        // parse ParetoMaterials: command
+        if (cmdType == "ParetoMaterials:") pareto.materials = SplitArgs(cmdArg);
+
+        // parse Pareto(layers,cm,pop,gens): command
+        if (cmdType == "Pareto(layers,cm,pop,gens):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 4) {cout << "Error: Pareto expects layers,cm,pop,gens" << endl; exit(EXIT_FAILURE);}
+          if (pareto.materials.empty()) {cout << "Error: Pareto needs ParetoMaterials" << endl; exit(EXIT_FAILURE);}
+          pareto.nLayers = stoi(args[0]);
+          pareto.tMax = stod(args[1]);
+          pareto.popSize = stoi(args[2]);
+          pareto.nGens = stoi(args[3]);
+          if (pareto.nLayers < 1 || pareto.tMax <= 0 || pareto.popSize < 2 || pareto.nGens < 1)
+            {cout << "Error: Pareto needs layers >= 1, cm > 0, pop >= 2 and gens >= 1" << endl; exit(EXIT_FAILURE);}
+          if (pareto.targets.empty()) pareto.targets.push_back(E);
+          pareto.cavity = cavity;
+          cout << "Searching " << pareto.nLayers << "-layer designs for " << pareto.nGens << " generations of " << pareto.popSize << endl;
+          PrintParetoFront(ParetoSearch(pareto), pareto);
+        }
+
+        // parse IdentifyMaterials: command
+        if (cmdType == "IdentifyMaterials:") identifyMaterials = SplitArgs(cmdArg);
+
+        // parse Identify(file,out,keV...): command
+        if (cmdType == "Identify(file,out,keV...):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() < 4) {cout << "Error: Identify expects file,out and at least two energies" << endl; exit(EXIT_FAILURE);}
+          if (args.size() - 2 > (size_t)PARAM_MAXCOLS) {cout << "Error: Identify takes at most " << PARAM_MAXCOLS << " energies" << endl; exit(EXIT_FAILURE);}
+          vector<double> energies;
+          for (size_t a = 2; a < args.size(); a++) energies.push_back(stod(args[a]));
+          vector<string> candidates = identifyMaterials.empty() ? DataFileAbsorbers() : identifyMaterials;
+          if (candidates.empty()) {cout << "Error: Identify needs IdentifyMaterials or Data/ files" << endl; exit(EXIT_FAILURE);}
+          chrono::steady_clock::time_point start = chrono::steady_clock::now();
+          IdentifyTable(candidates, energies, args[0], args[1]);
+          cout << "  " << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s" << endl;
+        }
+
+        // parse HypercubeAxis(type,cm): command
+        if (cmdType == "HypercubeAxis(type,cm):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 2) {cout << "Error: HypercubeAxis expects type,cm" << endl; exit(EXIT_FAILURE);}
+          hypercubeAxes.push_back(Layer{args[0], stod(args[1])});
+        }
+
+        // parse HypercubeBuild(file,keV,keV,nE,nt): command
+        if (cmdType == "HypercubeBuild(file,keV,keV,nE,nt):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 5) {cout << "Error: HypercubeBuild expects file,keV,keV,nE,nt" << endl; exit(EXIT_FAILURE);}
+          cout << "Building hypercube of " << hypercubeAxes.size() << " layers over " << args[1] << "-" << args[2] << " keV" << endl;
+          BuildHypercube(args[0], hypercubeAxes, stod(args[1]), stod(args[2]), stoi(args[3]), stoi(args[4]));
+        }
+
+        // parse HypercubeOpen(file): command
+        if (cmdType == "HypercubeOpen(file):")
+        {
+          if (hypercube.map) CloseHypercube(hypercube);
+          hypercube = OpenHypercube(cmdArg);
+          cout << "Mapped hypercube " << cmdArg << " with " << hypercube.header->k << " layers" << endl;
+        }
+
+        // parse HypercubeQuery(keV,cm...): command
+        if (cmdType == "HypercubeQuery(keV,cm...):")
+        {
+          if (!hypercube.map) {cout << "Error: HypercubeQuery needs HypercubeOpen" << endl; exit(EXIT_FAILURE);}
+          vector<string> args = SplitArgs(cmdArg);
+          if ((int)args.size() != hypercube.header->k + 1) {cout << "Error: HypercubeQuery expects keV and one thickness per layer" << endl; exit(EXIT_FAILURE);}
+          double Eq = stod(args[0]), t[HYPERCUBE_MAXAXES], estimate;
+          vector<Layer> query;
+          for (int a = 0; a < hypercube.header->k; a++)
+          {
+            t[a] = stod(args[a+1]);
+            query.push_back(Layer{hypercube.header->names[a], t[a]});
+          }
+          double T = QueryHypercube(hypercube, Eq, t, &estimate);
+          cout << "Hypercube T at " << Eq << " keV: " << T << " (estimated ln T error " << estimate << "), exact " << StackTransmit(query, Eq) << endl;
+        }
+
+        // parse Import(manifest,db): command
+        if (cmdType == "Import(manifest,db):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 2) {cout << "Error: Import expects manifest,db" << endl; exit(EXIT_FAILURE);}
+          cout << "Importing materials listed in " << args[0] << endl;
+          ImportMaterials(args[0], args[1]);
+        }
+
+        // parse MaterialDB(file): command
+        if (cmdType == "MaterialDB(file):") LoadMaterialDB(cmdArg);
+
+        // parse PackTables(numa): command
+        if (cmdType == "PackTables(numa):")
+        {
+          if (cmdArg != "on" && cmdArg != "off") {cout << "Error: PackTables expects on or off" << endl; exit(EXIT_FAILURE);}
+          cout << "Packing coefficient tables" << (cmdArg == "on" ? " per NUMA node" : "") << endl;
+          PackTables(cmdArg == "on");
+        }
+
+        // parse Snapshot(file): command
+        if (cmdType == "Snapshot(file):") SaveSnapshot(cmdArg);
+
+        // parse Restore(file): command
+        if (cmdType == "Restore(file):") RestoreSnapshot(cmdArg);
+
+        // parse Source(cm,cm,cm): command
+        if (cmdType == "Source(cm,cm,cm):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 3) {cout << "Error: Source expects x,y,z" << endl; exit(EXIT_FAILURE);}
+          for (int a = 0; a < 3; a++) source[a] = stod(args[a]);
+        }
+
+        // parse Activity(Bq): command
+        if (cmdType == "Activity(Bq):") activity = stod(cmdArg);
+
+        // parse DoseRegion(cm): command
+        if (cmdType == "DoseRegion(cm):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 6) {cout << "Error: DoseRegion expects x0,x1,y0,y1,z0,z1" << endl; exit(EXIT_FAILURE);}
+          for (int a = 0; a < 6; a++) doseRegion[a] = stod(args[a]);
+        }
+
+        // parse DoseMap(file,n0,depth,tol): command
+        if (cmdType == "DoseMap(file,n0,depth,tol):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 4) {cout << "Error: DoseMap expects file,n0,depth,tol" << endl; exit(EXIT_FAILURE);}
+          cout << "Mapping dose rate around " << stack.size() << " layers at " << E << " keV" << endl;
+          ShieldModel model = MakeShieldModel(cavity, stack, E);
+          AdaptiveDoseMap(model, source, activity, doseRegion, stoi(args[1]), stoi(args[2]), stod(args[3]), args[0]);
+        }
+
+        // parse SingleScatter(cm,cm,nz,nr): command
+        if (cmdType == "SingleScatter(cm,cm,nz,nr):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 4) {cout << "Error: SingleScatter expects cm,cm,nz,nr" << endl; exit(EXIT_FAILURE);}
+          cout << "Integrating single scatter through " << stack.size() << " slabs at " << E << " keV" << endl;
+          ScatterResult sr = SingleScatter(stack, E, stod(args[0]), stod(args[1]), stoi(args[2]), stoi(args[3]));
+          cout << "  Uncollided flux " << sr.uncollided << " /cm^2, single-scatter flux " << sr.scattered << " /cm^2 per source photon" << endl;
+          cout << "  Flux buildup " << 1 + sr.scattered / sr.uncollided << ", air kerma buildup " << 1 + sr.scatteredKerma / sr.uncollidedKerma << endl;
+          cout << "  Air kerma rate " << activity * (sr.uncollidedKerma + sr.scatteredKerma) * 3600. << " Gy/h" << endl;
+        }
+
+        // parse SNWeight: command
+        if (cmdType == "SNWeight:")
+        {
+          snCollapse = (cmdArg != "midpoint");
+          if (snCollapse) snWeight = ReadWeightSpectrum(cmdArg);
+        }
+
+        // parse Collapse(file,groups,keV,keV,weight): command
+        if (cmdType == "Collapse(file,groups,keV,keV,weight):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 5) {cout << "Error: Collapse expects file,groups,keV,keV,weight" << endl; exit(EXIT_FAILURE);}
+          int G = stoi(args[1]);
+          double Ehi = stod(args[2]), Elo = stod(args[3]);
+          if (G < 1 || Elo <= 0 || Ehi <= Elo) {cout << "Error: Collapse needs groups >= 1 and keV > keV > 0" << endl; exit(EXIT_FAILURE);}
+          if (stack.empty()) {cout << "Error: Collapse needs a stack" << endl; exit(EXIT_FAILURE);}
+          cout << "Collapsing into " << G << " groups from " << Ehi << " down to " << Elo << " keV, weight " << args[4] << endl;
+          WriteCollapsed(stack, LogGroups(Ehi, Elo, G), ReadWeightSpectrum(args[4]), args[0]);
+        }
+
+        // parse SN(order,groups,keV): command
+        if (cmdType == "SN(order,groups,keV):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 3) {cout << "Error: SN expects order,groups,keV" << endl; exit(EXIT_FAILURE);}
+          int order = stoi(args[0]), G = stoi(args[1]);
+          double cutoff = stod(args[2]);
+          if (order < 2 || order % 2) {cout << "Error: SN order must be even" << endl; exit(EXIT_FAILURE);}
+          if (G < 1 || cutoff <= 0 || cutoff >= E) {cout << "Error: SN needs groups >= 1 and 0 < keV < the Gamma energy" << endl; exit(EXIT_FAILURE);}
+          if (stack.empty()) {cout << "Error: SN needs a stack" << endl; exit(EXIT_FAILURE);}
+          cout << "Solving S" << order << " transport in " << G << " groups through " << stack.size() << " slabs at " << E << " keV" << endl;
+          Multigroup mg = BuildMultigroup(stack, E, cutoff, G, min(order - 1, 8), snCollapse ? &snWeight : NULL);
+          SNResult sn = SolveSN(stack, mg, E, order, 20000);
+          double collided = 0.0, energy = sn.uncollided * E, albedo = 0.0;
+          for (int g = 0; g < G; g++) {collided += sn.transmitted[g]; energy += sn.transmitted[g] * mg.Emid[g]; albedo += sn.reflected[g];}
+          cout << "  Transmitted uncollided " << sn.uncollided << ", scattered " << collided << ", reflected " << albedo << " per incident photon (" << sn.sweeps << " sweeps)" << endl;
+          cout << "  Number buildup " << (sn.uncollided + collided) / sn.uncollided << ", energy buildup " << energy / (sn.uncollided * E) << endl;
+        }
+
+        // parse StackBatch(file,out,keV...): command
+        if (cmdType == "StackBatch(file,out,keV...):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() < 3) {cout << "Error: StackBatch expects file,out and at least one keV" << endl; exit(EXIT_FAILURE);}
+          vector<double> energies;
+          for (size_t a = 2; a < args.size(); a++) energies.push_back(stod(args[a]));
+          StackBatch batch = PackStacks(ReadStacks(args[0]));
+          cout << "Evaluating " << batch.nStacks << " stacks at " << energies.size() << " energies" << endl;
+          vector<double> T = BatchTransmit(batch, energies);
+          ofstream out(args[1]);
+          if (!out.is_open()) {cout << "Error: StackBatch output not open" << endl; exit(EXIT_FAILURE);}
+          for (int s = 0; s < batch.nStacks; s++)
+          {
+            for (size_t e = 0; e < energies.size(); e++) out << (e ? " " : "") << T[s * energies.size() + e];
+            out << endl;
+          }
+        }
+
+        // parse SweepPlot(file,mode,buckets): command
+        if (cmdType == "SweepPlot(file,mode,buckets):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 3 || (args[1] != "minmax" && args[1] != "lttb" && args[1] != "off") || stol(args[2]) < 3)
+            {cout << "Error: SweepPlot expects file,minmax|lttb|off,buckets (at least 3)" << endl; exit(EXIT_FAILURE);}
+          sweepPlotFile = (args[1] == "off") ? "" : args[0];
+          sweepPlotMode = args[1];
+          sweepBuckets = stol(args[2]);
+        }
+
+        // parse Sweep(file,keV,keV,n): command
+        if (cmdType == "Sweep(file,keV,keV,n):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 4) {cout << "Error: Sweep expects file,keV,keV,n" << endl; exit(EXIT_FAILURE);}
+          string fullFile = (args[0] == "none") ? "" : args[0];
+          long nPoints = (long)stod(args[3]);
+          if (nPoints < 2 || stod(args[1]) <= 0 || stod(args[2]) <= stod(args[1])) {cout << "Error: Sweep needs 0 < keV < keV and n >= 2" << endl; exit(EXIT_FAILURE);}
+          cout << "Sweeping " << stack.size() << " layers over " << args[1] << "-" << args[2] << " keV at " << nPoints << " energies" << endl;
+          chrono::steady_clock::time_point start = chrono::steady_clock::now();
+          SweepTransmission(stack, stod(args[1]), stod(args[2]), nPoints, fullFile, sweepPlotFile, sweepPlotMode, sweepBuckets);
+          cout << "  " << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s" << endl;
+        }
+
+        // parse SweepAdaptive(file,keV,keV,tol): command
+        if (cmdType == "SweepAdaptive(file,keV,keV,tol):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 4) {cout << "Error: SweepAdaptive expects file,keV,keV,tol" << endl; exit(EXIT_FAILURE);}
+          if (stod(args[1]) <= 0 || stod(args[2]) <= stod(args[1]) || stod(args[3]) <= 0) {cout << "Error: SweepAdaptive needs 0 < keV < keV and tol > 0" << endl; exit(EXIT_FAILURE);}
+          cout << "Adaptive sweep of " << stack.size() << " layers over " << args[1] << "-" << args[2] << " keV to " << args[3] << " in ln T" << endl;
+          long evaluations = AdaptiveSweep(stack, stod(args[1]), stod(args[2]), stod(args[3]), args[0]);
+          cout << "  " << evaluations << " energies evaluated" << endl;
+        }
+
+        // parse Unfold(file,out,fwhm,iters): command
+        if (cmdType == "Unfold(file,out,fwhm,iters):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 4) {cout << "Error: Unfold expects file,out,fwhm,iters" << endl; exit(EXIT_FAILURE);}
+          if (stod(args[2]) < 0 || stoi(args[3]) < 1) {cout << "Error: Unfold needs fwhm >= 0 and iters >= 1" << endl; exit(EXIT_FAILURE);}
+          Unfold(stack, args[0], args[1], stod(args[2]), stoi(args[3]));
+        }
+
+        // parse Seed: command
+        if (cmdType == "Seed:") seed = stoul(cmdArg);
+
+        // parse TransportMode: command
+        if (cmdType == "TransportMode:")
+        {
+          if (cmdArg != "history" && cmdArg != "event") {cout << "Error: TransportMode expects history or event" << endl; exit(EXIT_FAILURE);}
+          eventBased = (cmdArg == "event");
+        }
+
+        // parse Tracking: command
+        if (cmdType == "Tracking:")
+        {
+          if (cmdArg != "surface" && cmdArg != "delta") {cout << "Error: Tracking expects surface or delta" << endl; exit(EXIT_FAILURE);}
+          deltaTracking = (cmdArg == "delta");
+        }
+
+        // parse Beam: command
+        if (cmdType == "Beam:")
+        {
+          if (cmdArg != "normal" && cmdArg != "diffuse") {cout << "Error: Beam expects normal or diffuse" << endl; exit(EXIT_FAILURE);}
+          diffuseBeam = (cmdArg == "diffuse");
+        }
+
+        // parse Tallies(file,bins,batches): command
+        if (cmdType == "Tallies(file,bins,batches):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 3 || stoi(args[1]) < 1) {cout << "Error: Tallies expects file,bins,batches" << endl; exit(EXIT_FAILURE);}
+          tallyFile = args[0];
+          tallyBins = stoi(args[1]);
+          tallyCheckpoint = stol(args[2]);
+        }
+
+        // parse Transport(histories,keV): command
+        if (cmdType == "Transport(histories,keV):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 2) {cout << "Error: Transport expects histories,keV" << endl; exit(EXIT_FAILURE);}
+          long histories = (long)stod(args[0]);
+          if (histories < 1) {cout << "Error: Transport needs histories >= 1" << endl; exit(EXIT_FAILURE);}
+          TransportConfig tc = {E, stod(args[1]), histories, seed, eventBased, deltaTracking, diffuseBeam, tallyBins, tallyFile.empty() ? 0 : tallyCheckpoint};
+          cout << "Transporting " << tc.histories << " photons (" << (eventBased ? "event" : "history") << "-based, " << (deltaTracking ? "delta" : "surface") << " tracking, " << (diffuseBeam ? "diffuse" : "normal") << " incidence) through " << stack.size() << " slabs at " << E << " keV" << endl;
+          double seconds;
+          TransportTally tt = RunTransport(stack, tc, seconds, [&](const TransportTally& t, long done)
+          {
+            WriteTallies(tallyFile, t, stack, E, done);
+            cout << "  Checkpoint: " << done << " histories, tallies written to " << tallyFile << endl;
+          });
+          if (!tallyFile.empty()) WriteTallies(tallyFile, tt, stack, E, tc.histories);
+          double n = tc.histories;
+          cout << "  Transmitted " << tt.transmitted / n << " (uncollided " << tt.uncollided / n << ", narrow-beam " << StackTransmit(stack, E) << "), reflected " << tt.reflected / n << ", absorbed " << tt.absorbed / n << endl;
+          cout << "  Energy transmitted " << tt.eTransmitted / (n * E) << ", reflected " << tt.eReflected / (n * E) << " of incident" << endl;
+          for (size_t i = 0; i < stack.size(); i++)
+            cout << "  Energy deposited in layer " << i << " (" << stack[i].absorber << "): " << tt.edep.sum[i] / (n * E) << " +- " << 100 * tt.edep.RelError(i) << "%" << endl;
+          cout << "  " << n / seconds << " histories/s" << endl;
+        }
+
+        // parse Adjoint(histories,keV): command
+        if (cmdType == "Adjoint(histories,keV):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 2) {cout << "Error: Adjoint expects histories,keV" << endl; exit(EXIT_FAILURE);}
+          if (stack.empty()) {cout << "Error: Adjoint needs a stack with a detector layer" << endl; exit(EXIT_FAILURE);}
+          long histories = (long)stod(args[0]);
+          if (histories < 1) {cout << "Error: Adjoint needs histories >= 1" << endl; exit(EXIT_FAILURE);}
+          AdjointConfig ac = {E, stod(args[1]), histories, seed};
+          cout << "Adjoint transport of " << ac.histories << " particles from " << stack.back().absorber << " through " << stack.size() << " slabs, diffuse source at " << E << " keV" << endl;
+          double seconds;
+          AdjointResult ar = RunAdjoint(stack, ac, seconds);
+          double total = ar.uncollided + ar.scattered, err = ar.scattered * ar.relError / total;
+          cout << "  Energy deposited in layer " << stack.size() - 1 << " (" << stack.back().absorber << ") per entering photon: " << total / E << " of incident +- " << 100 * err << "%" << endl;
+          cout << "  Uncollided " << ar.uncollided / E << ", scattered " << ar.scattered / E << endl;
+          if (err > 0) cout << "  Figure of merit " << 1 / (err * err * seconds) << " /s, " << ac.histories / seconds << " histories/s" << endl;
+        }
+
+        // parse Waypoint(cm,cm,cm,s): command
+        if (cmdType == "Waypoint(cm,cm,cm,s):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 4) {cout << "Error: Waypoint expects x,y,z,t" << endl; exit(EXIT_FAILURE);}
+          Waypoint wp = {{stod(args[0]), stod(args[1]), stod(args[2])}, stod(args[3])};
+          if (!waypoints.empty() && wp.t < waypoints.back().t) {cout << "Error: Waypoint times must not decrease" << endl; exit(EXIT_FAILURE);}
+          waypoints.push_back(wp);
+        }
+
+        // parse Detector(cm,cm,cm): command
+        if (cmdType == "Detector(cm,cm,cm):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 3) {cout << "Error: Detector expects x,y,z" << endl; exit(EXIT_FAILURE);}
+          for (int a = 0; a < 3; a++) detector[a] = stod(args[a]);
+        }
+
+        // parse Trajectory(mode,tol): command
+        if (cmdType == "Trajectory(mode,tol):")
+        {
+          vector<string> args = SplitArgs(cmdArg);
+          if (args.size() != 2 || (args[0] != "detector" && args[0] != "source")) {cout << "Error: Trajectory expects detector|source,tol" << endl; exit(EXIT_FAILURE);}
+          if (waypoints.size() < 2) {cout << "Error: Trajectory needs at least two waypoints" << endl; exit(EXIT_FAILURE);}
+          cout << "Integrating dose along " << waypoints.size() << " waypoints with the " << args[0] << " moving" << endl;
+          ShieldModel model = MakeShieldModel(cavity, stack, E);
+          TrajectoryResult tr = IntegrateTrajectory(model, source, args[0] == "source" ? detector : NULL, activity, waypoints, stod(args[1]));
+          cout << "  Dose " << tr.dose << " Gy over " << waypoints.back().t - waypoints.front().t << " s, peak rate " << tr.peakRate << " Gy/h (" << tr.evaluations << " evaluations)" << endl;
+        }
       } // end while getline() loop
+      CloseSpan();
       // close macro file
       ifs.close();
+      if (hypercube.map) CloseHypercube(hypercube);
+      FreeTables();
     } // end file is_open() loop
     else {cout << "Error: Macro file not open" << endl; exit(EXIT_FAILURE);}
 
     // exit program
     return 0;
 }
+
+// main: serve as the zygote, hand the run to one, or run here
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && string(argv[1]) == "--zygote")
+    {
+      if (argc != 3 && argc != 4) {cout << "Usage: ./CalcAtten --zygote <socket> [snapshot]" << endl; exit(EXIT_FAILURE);}
+      ServeZygote(argv[2], RunCalcAtten, argc == 4 ? argv[3] : "");
+    }
+    int status;
+    if (RunInZygote(argc, argv, status)) return status;
+    return RunCalcAtten(argc, argv);
+}
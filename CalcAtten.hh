@@ -7,7 +7,7 @@
 *   macro.txt: a macro file  specifying the radiation type and energy, and the layers of shielding
 *
 * Usage:
-*   compile: g++ -g -Wall -oCalcAtten CalcAtten.cc
+*   compile: g++ -g -O2 -Wall -pthread -oCalcAtten CalcAtten.cc
 *   execute: ./CalcAtten macro.txt
 *
 * Ref:
@@ -27,9 +27,15 @@
 #include <vector> // storing arrays of values, with the array sizes changing on the fly
 #include <cmath> // exp() and fabs() functions
 #include <algorithm> // lower_bound() and upper_bound() algorithms
+#include <sstream> // istringstream for parsing lines of numbers
+#include <map> // caching loaded materials by name
+#include <functional> // passing loop bodies to ParallelFor()
+#include <thread> // worker threads for ParallelFor()
+#include <atomic> // shared iteration counter for ParallelFor()
+#include <dirent.h> // listing the Data/ files
 using namespace std; // implied namespace for std library objects
 
-int Closest(vector<double>& vec, double val)
+int Closest(const vector<double>& vec, double val)
 {
   /*******
   * Find entry closest to val in vec
@@ -38,8 +44,8 @@ int Closest(vector<double>& vec, double val)
   * upper_bound returns iterator to first element in the range [first,last) which compares greater than val
   *******/
 
-  vector<double>::iterator lb = lower_bound(vec.begin(), vec.end(), val) - 1; // subtracted off 1 index; see note above
-  vector<double>::iterator ub = upper_bound(vec.begin(), vec.end(), val);
+  vector<double>::const_iterator lb = lower_bound(vec.begin(), vec.end(), val) - 1; // subtracted off 1 index; see note above
+  vector<double>::const_iterator ub = upper_bound(vec.begin(), vec.end(), val);
   cout << "  Closest energies in data for " << val << ": " << *lb << " " << *ub << endl;
   return (fabs(*ub - val) > fabs(*lb - val)) ? lb - vec.begin() : ub - vec.begin();
 }
@@ -49,12 +55,62 @@ string DataFilePath(string absorber)
   return "Data/" + absorber + "Data.txt";
 }
 
+vector<string> DataFileAbsorbers()
+{
+  /*******
+  * Return the absorbers that have a data file in Data/, sorted by name; empty if there is no Data/ directory
+  *******/
+
+  vector<string> absorbers;
+  DIR* dir = opendir("Data");
+  if (!dir) return absorbers;
+  for (dirent* ent = readdir(dir); ent; ent = readdir(dir))
+  {
+    string name = ent->d_name;
+    if (name.size() > 8 && name.compare(name.size() - 8, 8, "Data.txt") == 0) absorbers.push_back(name.substr(0, name.size() - 8));
+  }
+  closedir(dir);
+  sort(absorbers.begin(), absorbers.end());
+  return absorbers;
+}
+
+struct WorkCounters
+{
+  /*******
+  * Work done by a thread, for per-request cost accounting (see Zygote.hh); ParallelFor() adds its workers'
+  * counts to the caller's when they finish
+  *******/
+
+  long layers; // attenuation coefficients looked up, counted once per kernel call or batch (not in MuRho(), nor
+               // for the single lookups of the Monte Carlo, whose work is its histories)
+  long energies; // stacks evaluated at one energy
+  long cacheHits; // materials and data files served from memory
+  long cacheMisses; // read from disk
+
+  WorkCounters operator-(const WorkCounters& o) const {return WorkCounters{layers - o.layers, energies - o.energies, cacheHits - o.cacheHits, cacheMisses - o.cacheMisses};}
+  void operator+=(const WorkCounters& o) {layers += o.layers; energies += o.energies; cacheHits += o.cacheHits; cacheMisses += o.cacheMisses;}
+};
+
+thread_local WorkCounters workCounters = {0, 0, 0, 0};
+
+struct DataFileTable
+{
+  double density; // as Density() reads it
+  vector<double> Es, MACs; // as MassAttenCoeff() reads them
+};
+
+map<string, DataFileTable> dataFileCache; // tables read ahead of time (see Zygote.hh) or from a MaterialDB, ahead of the data files
+
 double Density(string absorber)
 {
   /*******
   * Return the density of the given absorber
   *******/
 
+  map<string, DataFileTable>::iterator it = dataFileCache.find(absorber);
+  if (it != dataFileCache.end()) {workCounters.cacheHits++; return it->second.density;}
+  workCounters.cacheMisses++;
+
   // create ifstream for data file and open file
   ifstream dataFile;
   dataFile.open(DataFilePath(absorber), ifstream::in);
@@ -91,19 +147,16 @@ double Density(string absorber)
   else {cout << "Error: Data file not open" << endl; exit(EXIT_FAILURE);}
 }
 
-double MassAttenCoeff(string absorber, double E)
+void ReadDataFileMACs(string absorber, vector<double>& Es, vector<double>& MACs)
 {
   /*******
-  * Return the mass attenuation coefficient of the given absorber, for a given radiation energy
+  * Fill Es (MeV) and MACs with the mass attenuation coefficients of the given absorber's data file
   *******/
 
   // create ifstream for data file
   ifstream dataFile;
   dataFile.open(DataFilePath(absorber), ifstream::in);
 
-  // create some vectors to store and search data
-  vector<double> Es, MACs;
-
   // open data file
   if (dataFile.is_open())
   {
@@ -137,6 +190,22 @@ double MassAttenCoeff(string absorber, double E)
     dataFile.close();
   } // end file is_open() loop
   else {cout << "Error: Data file not open" << endl; exit(EXIT_FAILURE);}
+}
+
+double MassAttenCoeff(string absorber, double E)
+{
+  /*******
+  * Return the mass attenuation coefficient of the given absorber, for a given radiation energy
+  *******/
+
+  // search the in-memory table where there is one, else read the data file into these vectors
+  vector<double> readEs, readMACs;
+  map<string, DataFileTable>::iterator it = dataFileCache.find(absorber);
+  if (it != dataFileCache.end()) workCounters.cacheHits++;
+  else {ReadDataFileMACs(absorber, readEs, readMACs); workCounters.cacheMisses++;}
+  const vector<double>& Es = (it != dataFileCache.end()) ? it->second.Es : readEs;
+  const vector<double>& MACs = (it != dataFileCache.end()) ? it->second.MACs : readMACs;
+  workCounters.layers++;
 
   // find and return the closest available MAC
   int i = Closest(Es, E/1000.); // E/1000. serves to convert from keV to MeV
@@ -159,3 +228,189 @@ double Transmit(string absorber, string thickness, double E)
   double c = MassAttenCoeff(absorber, E);
   return exp(-1 * c * rho * t);
 }
+
+/*******
+* In-memory material tables
+*   The functions above re-read the data file on every call, which is fine for a handful of layers.
+*   Searches and sweeps that evaluate millions of stacks load each material once into a Material,
+*   and then work only with the tables held in memory.
+*******/
+
+struct Material
+{
+  string name;
+  double density; // g/cm^3
+  double ZoverA; // electrons per atomic mass unit (mol/g); 0 if the data file has no Z/A(mol/g): line
+  vector<double> Es; // energies (MeV), repeated at absorption edges
+  vector<double> MACs; // mass attenuation coefficients (cm^2/g)
+  vector<double> MEACs; // mass energy-absorption coefficients (cm^2/g)
+};
+
+map<string, Material> materialCache; // loaded materials, by absorber name
+map<string, Material> preloadedMaterials; // read ahead of time by a zygote (see Zygote.hh), loaded on first use
+
+struct Layer
+{
+  string absorber;
+  double thickness; // cm
+};
+
+vector<string> SplitArgs(string args, char delim = ',')
+{
+  /*******
+  * Split a macro argument string like "cyl,10,20" into its comma-separated fields
+  *******/
+
+  vector<string> fields;
+  string::size_type start = 0, n;
+  while ((n = args.find(delim, start)) != string::npos)
+  {
+    fields.push_back(args.substr(start, n - start));
+    start = n + 1;
+  }
+  fields.push_back(args.substr(start, string::npos));
+  return fields;
+}
+
+Material& LoadMaterial(string absorber)
+{
+  /*******
+  * Return the in-memory tables of the given absorber, reading its data file only on first use
+  * Not thread safe: load every material needed before starting a ParallelFor()
+  *******/
+
+  map<string, Material>::iterator it = materialCache.find(absorber);
+  if (it != materialCache.end()) {workCounters.cacheHits++; return it->second;}
+  it = preloadedMaterials.find(absorber);
+  if (it != preloadedMaterials.end()) {workCounters.cacheHits++; return materialCache[absorber] = it->second;}
+  workCounters.cacheMisses++;
+
+  // create ifstream for data file and open file
+  ifstream dataFile;
+  dataFile.open(DataFilePath(absorber), ifstream::in);
+  if (!dataFile.is_open()) {cout << "Error: Data file not open for " << absorber << endl; exit(EXIT_FAILURE);}
+
+  Material mat;
+  mat.name = absorber;
+  mat.density = -1.0;
+  mat.ZoverA = 0.0;
+
+  // prep vars for holding data lines, and positions and substrings of those lines
+  string line, lineType, lineArg;
+  string::size_type n;
+
+  // get line from data
+  while (getline(dataFile, line))
+  {
+    // parse line in data file
+    n = line.find(" ");
+    if (n == string::npos) {cout << "Error: Unexpected data file format" << endl; exit(EXIT_FAILURE);}
+    lineType = line.substr(0, n); // substr returns [pos, pos+count)
+    lineArg = line.substr(n+1, string::npos);
+
+    if (lineType == "Density(g/cm^3):") mat.density = stod(lineArg);
+    if (lineType == "Z/A(mol/g):") mat.ZoverA = stod(lineArg);
+    if (lineType == "MAC(MeV,cm^2/g,cm^2/g):")
+    {
+      double e, mac, meac;
+      istringstream iss(lineArg);
+      if (!(iss >> e >> mac >> meac)) {cout << "Error: Unexpected MAC line in data file for " << absorber << endl; exit(EXIT_FAILURE);}
+      mat.Es.push_back(e);
+      mat.MACs.push_back(mac);
+      mat.MEACs.push_back(meac);
+    }
+  }
+  dataFile.close();
+
+  if (mat.density <= 0) {cout << "Error: No density found in data file for " << absorber << endl; exit(EXIT_FAILURE);}
+  if (mat.Es.size() < 2) {cout << "Error: Too few MAC lines in data file for " << absorber << endl; exit(EXIT_FAILURE);}
+
+  return materialCache[absorber] = mat;
+}
+
+double LogLogInterp(const vector<double>& xs, const vector<double>& ys, double x)
+{
+  /*******
+  * Log-log interpolate the table (xs, ys) at x, as recommended for the NIST tables
+  * At a repeated x (absorption edge) the value above the edge is used
+  * Values outside the table are clamped to the first/last entry
+  *******/
+
+  if (x <= xs.front()) return ys.front();
+  if (x >= xs.back()) return ys.back();
+  size_t i = upper_bound(xs.begin(), xs.end(), x) - xs.begin(); // xs[i-1] <= x < xs[i]
+  double f = log(x / xs[i-1]) / log(xs[i] / xs[i-1]);
+  return exp(log(ys[i-1]) + f * (log(ys[i]) - log(ys[i-1])));
+}
+
+double LogLogInterpFrom(const vector<double>& xs, const vector<double>& ys, double x, size_t& i)
+{
+  /*******
+  * LogLogInterp(), with the search walking from the interval i of the previous call instead of bisecting
+  * Gives the same value; cheap when successive x are close, as for energies taken in sorted order
+  *******/
+
+  if (x <= xs.front()) return ys.front();
+  if (x >= xs.back()) return ys.back();
+  if (i < 1 || i >= xs.size()) i = 1;
+  while (xs[i] <= x) i++;
+  while (xs[i-1] > x) i--;
+  double f = log(x / xs[i-1]) / log(xs[i] / xs[i-1]);
+  return exp(log(ys[i-1]) + f * (log(ys[i]) - log(ys[i-1])));
+}
+
+double MuRho(const Material& mat, double E)
+{
+  /*******
+  * Return the linear attenuation coefficient mu = (mu/rho)*rho (1/cm) of mat at energy E (keV)
+  *******/
+
+  return LogLogInterp(mat.Es, mat.MACs, E/1000.) * mat.density; // E/1000. converts keV to MeV
+}
+
+double StackTransmit(const vector<Layer>& stack, double E)
+{
+  /*******
+  * Return the narrow-beam fraction transmitted through all layers of stack at energy E (keV)
+  * Quiet, in-memory counterpart of multiplying Transmit() over the layers
+  *******/
+
+  double tau = 0.0; // optical thickness
+  workCounters.energies++;
+  workCounters.layers += stack.size();
+  for (size_t i = 0; i < stack.size(); i++) tau += MuRho(LoadMaterial(stack[i].absorber), E) * stack[i].thickness;
+  return exp(-tau);
+}
+
+int numThreads = 0; // worker threads for ParallelFor(); 0 means one per hardware thread
+function<void(int)> workerInit; // if set, run by every ParallelFor() worker thread with its worker index before any work
+
+void ParallelFor(int n, function<void(int)> body)
+{
+  /*******
+  * Run body(i) for every i in [0,n) across worker threads
+  * Iterations are handed out in small blocks from a shared counter; body must only write to slots owned by i
+  *******/
+
+  int nThreads = numThreads > 0 ? numThreads : (int)thread::hardware_concurrency();
+  if (nThreads < 1) nThreads = 1;
+  if (nThreads > n) nThreads = n;
+  if (nThreads <= 1) {for (int i = 0; i < n; i++) body(i); return;}
+
+  int block = max(1, n / (nThreads * 16));
+  atomic<int> next(0);
+  vector<thread> workers;
+  vector<WorkCounters> counts(nThreads);
+  for (int w = 0; w < nThreads; w++)
+  {
+    workers.push_back(thread([&, w]()
+    {
+      if (workerInit) workerInit(w);
+      int i0;
+      while ((i0 = next.fetch_add(block)) < n)
+        for (int i = i0; i < min(n, i0 + block); i++) body(i);
+      counts[w] = workCounters;
+    }));
+  }
+  for (size_t w = 0; w < workers.size(); w++) {workers[w].join(); workCounters += counts[w];}
+}
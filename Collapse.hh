@@ -0,0 +1,181 @@
+/*******
+* Collapse.hh
+*   Multigroup collapse: each material's pointwise coefficients averaged over energy groups, weighted by a spectrum.
+*
+* Dependencies:
+*   CalcAtten.hh: Material, Layer, LoadMaterial(), LogLogInterp() and workCounters
+*   Scatter.hh: GaussLegendre()
+*
+* Groups and weights:
+*   group boundaries Eb (keV) run downwards, as in SN.hh: group g is [Eb[g+1], Eb[g]]
+*   the weight w(E) is per keV: "lethargy" is 1/E (flat per unit ln E, the usual choice with no better
+*   knowledge of the flux), or a spectrum file, "keV weight" per line in increasing energy (empty lines and
+*   lines starting with '#' skipped), linear between its points and 0 outside them
+*
+* Method:
+*   mu_g = integral of mu/rho(E) w(E) dE / integral of w(E) dE over the group, for mu/rho and mu_en/rho
+*   each group is split at every energy of the material's table (edges included) and of the spectrum, so the
+*   integrand is smooth on every piece (a power law times a line), which is integrated by COLLAPSE_QUADRATURE
+*   point Gauss-Legendre in ln E; nodes never fall on a piece's ends, so each side of an edge gets its own value
+*   a group with no weight in it takes the pointwise values at its log midpoint
+*
+* Cache:
+*   results are kept in collapseCache, keyed by the material's data, the group boundaries and the weight
+*   (a spectrum file by its contents), so a solver asking again for the same groups pays a map lookup; hits and
+*   misses are counted in workCounters
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+const int COLLAPSE_QUADRATURE = 8;
+
+struct WeightSpectrum
+{
+  string key; // "lethargy", or the file name and its points
+  vector<double> E, w; // keV, weight per keV; empty for lethargy
+};
+
+struct CollapsedGroups
+{
+  vector<double> mu; // [g] group-averaged mu/rho (cm^2/g)
+  vector<double> muen; // [g] group-averaged mu_en/rho (cm^2/g), 0 if the material has none
+  vector<double> weight; // [g] integral of the weight over the group
+};
+
+map<string, CollapsedGroups> collapseCache;
+
+WeightSpectrum ReadWeightSpectrum(string arg)
+{
+  /*******
+  * The weight named by a macro argument: lethargy, or a spectrum file; see the header of this file
+  *******/
+
+  WeightSpectrum ws;
+  ws.key = arg;
+  if (arg == "lethargy") return ws;
+  ifstream in(arg);
+  if (!in.is_open()) {cout << "Error: Weight spectrum not open" << endl; exit(EXIT_FAILURE);}
+  string line;
+  while (getline(in, line))
+  {
+    string::size_type first = line.find_first_not_of(" \t\r");
+    if (first == string::npos || line[first] == '#') continue;
+    istringstream iss(line);
+    double e, w;
+    if (!(iss >> e >> w) || e <= 0 || w < 0) {cout << "Error: Bad weight spectrum line: " << line << endl; exit(EXIT_FAILURE);}
+    if (!ws.E.empty() && e <= ws.E.back()) {cout << "Error: Weight spectrum energies must increase" << endl; exit(EXIT_FAILURE);}
+    ws.E.push_back(e);
+    ws.w.push_back(w);
+  }
+  if (ws.E.size() < 2) {cout << "Error: Weight spectrum needs at least 2 points" << endl; exit(EXIT_FAILURE);}
+  ws.key = "file:" + arg + '\0' + string((const char*)ws.E.data(), ws.E.size() * sizeof(double))
+           + string((const char*)ws.w.data(), ws.w.size() * sizeof(double));
+  return ws;
+}
+
+double Weight(const WeightSpectrum& ws, double E)
+{
+  /*******
+  * The weight per keV at E (keV)
+  *******/
+
+  if (ws.E.empty()) return 1.0 / E;
+  if (E < ws.E.front() || E > ws.E.back()) return 0.0;
+  size_t i = upper_bound(ws.E.begin(), ws.E.end(), E) - ws.E.begin();
+  if (i >= ws.E.size()) return ws.w.back();
+  return ws.w[i-1] + (ws.w[i] - ws.w[i-1]) * (E - ws.E[i-1]) / (ws.E[i] - ws.E[i-1]);
+}
+
+vector<double> LogGroups(double Ehi, double Elo, int G)
+{
+  /*******
+  * G log-spaced groups from Ehi down to Elo (keV), as boundaries
+  *******/
+
+  vector<double> Eb;
+  for (int g = 0; g <= G; g++) Eb.push_back(Ehi * pow(Elo / Ehi, (double)g / G));
+  return Eb;
+}
+
+const CollapsedGroups& CollapseMaterial(const Material& mat, const vector<double>& Eb, const WeightSpectrum& ws)
+{
+  /*******
+  * Group-averaged coefficients of mat on the groups Eb, weighted by ws; computed once per distinct request
+  *******/
+
+  string key = mat.name + '\0' + string((const char*)&mat.density, sizeof(double))
+               + string((const char*)mat.Es.data(), mat.Es.size() * sizeof(double))
+               + string((const char*)mat.MACs.data(), mat.MACs.size() * sizeof(double)) + '\0'
+               + string((const char*)Eb.data(), Eb.size() * sizeof(double)) + '\0' + ws.key;
+  map<string, CollapsedGroups>::iterator it = collapseCache.find(key);
+  if (it != collapseCache.end()) {workCounters.cacheHits++; return it->second;}
+  workCounters.cacheMisses++;
+
+  vector<double> x, xw;
+  GaussLegendre(COLLAPSE_QUADRATURE, x, xw);
+  bool hasEA = (mat.MEACs.size() == mat.Es.size());
+  int G = Eb.size() - 1;
+  CollapsedGroups cg;
+  cg.mu.assign(G, 0.0);
+  cg.muen.assign(G, 0.0);
+  cg.weight.assign(G, 0.0);
+  for (int g = 0; g < G; g++)
+  {
+    double lo = Eb[g+1], hi = Eb[g];
+    vector<double> nodes(1, lo);
+    for (size_t j = 0; j < mat.Es.size(); j++) if (mat.Es[j] * 1000. > lo && mat.Es[j] * 1000. < hi) nodes.push_back(mat.Es[j] * 1000.);
+    for (size_t j = 0; j < ws.E.size(); j++) if (ws.E[j] > lo && ws.E[j] < hi) nodes.push_back(ws.E[j]);
+    nodes.push_back(hi);
+    sort(nodes.begin(), nodes.end());
+    nodes.erase(unique(nodes.begin(), nodes.end()), nodes.end());
+
+    double sumW = 0.0, sumMu = 0.0, sumMuen = 0.0;
+    for (size_t p = 0; p + 1 < nodes.size(); p++)
+    {
+      double t0 = log(nodes[p]), t1 = log(nodes[p+1]);
+      for (int q = 0; q < COLLAPSE_QUADRATURE; q++)
+      {
+        double E = exp(0.5 * (t0 + t1) + 0.5 * (t1 - t0) * x[q]);
+        double f = Weight(ws, E) * E * 0.5 * (t1 - t0) * xw[q]; // w(E) dE = w(E) E d(ln E)
+        sumW += f;
+        sumMu += f * LogLogInterp(mat.Es, mat.MACs, E/1000.);
+        if (hasEA) sumMuen += f * LogLogInterp(mat.Es, mat.MEACs, E/1000.);
+      }
+      workCounters.layers += COLLAPSE_QUADRATURE;
+    }
+    cg.weight[g] = sumW;
+    if (sumW > 0) {cg.mu[g] = sumMu / sumW; cg.muen[g] = sumMuen / sumW;}
+    else
+    {
+      double mid = sqrt(lo * hi) / 1000.;
+      cg.mu[g] = LogLogInterp(mat.Es, mat.MACs, mid);
+      if (hasEA) cg.muen[g] = LogLogInterp(mat.Es, mat.MEACs, mid);
+    }
+  }
+  return collapseCache[key] = cg;
+}
+
+void WriteCollapsed(const vector<Layer>& stack, const vector<double>& Eb, const WeightSpectrum& ws, string fileName)
+{
+  /*******
+  * Collapse every distinct material of stack and write "material g keV keV mu/rho mu_en/rho weight" per group
+  *******/
+
+  ofstream out(fileName);
+  if (!out.is_open()) {cout << "Error: Collapse output not open" << endl; exit(EXIT_FAILURE);}
+  out.precision(10);
+  out << "# " << Eb.size() - 1 << " groups from " << Eb.front() << " down to " << Eb.back() << " keV, weight "
+      << (ws.E.empty() ? ws.key : ws.key.substr(5, ws.key.find('\0') - 5)) << "\n";
+  out << "# material group keV_hi keV_lo mu/rho(cm^2/g) mu_en/rho(cm^2/g) weight\n";
+  vector<string> done;
+  for (size_t l = 0; l < stack.size(); l++)
+  {
+    if (find(done.begin(), done.end(), stack[l].absorber) != done.end()) continue;
+    done.push_back(stack[l].absorber);
+    const CollapsedGroups& cg = CollapseMaterial(LoadMaterial(stack[l].absorber), Eb, ws);
+    for (size_t g = 0; g + 1 < Eb.size(); g++)
+      out << stack[l].absorber << " " << g << " " << Eb[g] << " " << Eb[g+1] << " " << cg.mu[g] << " " << cg.muen[g] << " " << cg.weight[g] << "\n";
+  }
+  cout << "  " << done.size() << " materials collapsed, " << collapseCache.size() << " collapses cached" << endl;
+}
@@ -0,0 +1,121 @@
+/*******
+* DoseMap.hh
+*   Adaptive (octree) dose mapping over a 3D region around a nested-shell shield.
+*
+* Dependencies:
+*   CalcAtten.hh: ParallelFor()
+*   Geometry.hh: ShieldModel and DoseRate()
+*
+* Description:
+*   The region starts as n0^3 cells. Each cell is evaluated at its 8 corners and its centre, and is split into
+*   8 children when ln(dose) at the centre differs from the mean of ln(dose) at the corners (the trilinear
+*   estimate) by more than tol, down to maxDepth levels. Points live on a lattice, so neighbouring cells share
+*   their corner evaluations; each level's new points are evaluated in parallel.
+*   The smaller tol, the closer the map comes to the uniform grid of the finest level; n0 * 2^(maxDepth+1) is
+*   capped at DOSEMAP_MAXSTEPS, so that every lattice point has its own key.
+*
+* Output:
+*   one line per leaf cell: "x y z dx dy dz dose(Gy/h)", at the cell centre, with its edge lengths along x, y, z
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <unordered_map> // lattice point -> dose cache
+
+const long DOSEMAP_MAXSTEPS = 2097150; // finest lattice steps per axis, so that (N+1)^3 point keys fit in a long
+
+struct DoseCell
+{
+  long ijk[3]; // lower corner on the finest lattice
+  long size; // edge length in lattice steps
+  int depth;
+};
+
+void AdaptiveDoseMap(const ShieldModel& model, const double* src, double activity, const double* region,
+                     int n0, int maxDepth, double tol, string fileName)
+{
+  /*******
+  * Map the dose rate over region = (x0,x1,y0,y1,z0,z1) (cm) and write the leaf cells to fileName
+  *******/
+
+  if (n0 < 1 || maxDepth < 0 || tol <= 0) {cout << "Error: DoseMap needs n0 >= 1, depth >= 0 and tol > 0" << endl; exit(EXIT_FAILURE);}
+
+  // finest lattice steps per axis, n0 * 2^(maxDepth+1); centres of the finest cells are lattice points
+  long N = n0;
+  for (int d = 0; d <= maxDepth && N <= DOSEMAP_MAXSTEPS; d++) N *= 2;
+  if (N > DOSEMAP_MAXSTEPS) {cout << "Error: DoseMap depth too fine for n0 (at most " << DOSEMAP_MAXSTEPS << " lattice steps per axis)" << endl; exit(EXIT_FAILURE);}
+  double step[3];
+  for (int a = 0; a < 3; a++) step[a] = (region[2*a+1] - region[2*a]) / N;
+  unordered_map<long, double> dose;
+  auto key = [&](long i, long j, long k) {return i + (N+1) * (j + (N+1) * k);};
+
+  vector<DoseCell> active, leaves;
+  for (long i = 0; i < n0; i++) for (long j = 0; j < n0; j++) for (long k = 0; k < n0; k++)
+  {
+    long s = N / n0;
+    active.push_back(DoseCell{{i*s, j*s, k*s}, s, 0});
+  }
+
+  while (!active.empty())
+  {
+    // collect and evaluate this level's new lattice points
+    vector<long> todo;
+    for (size_t c = 0; c < active.size(); c++)
+    {
+      const DoseCell& cell = active[c];
+      long h = cell.size / 2;
+      for (int corner = 0; corner < 9; corner++)
+      {
+        long i = cell.ijk[0] + (corner == 8 ? h : (corner & 1) * cell.size);
+        long j = cell.ijk[1] + (corner == 8 ? h : ((corner >> 1) & 1) * cell.size);
+        long k = cell.ijk[2] + (corner == 8 ? h : ((corner >> 2) & 1) * cell.size);
+        long kk = key(i, j, k);
+        if (dose.find(kk) == dose.end()) {dose[kk] = 0.0; todo.push_back(kk);}
+      }
+    }
+    vector<double> values(todo.size());
+    ParallelFor(todo.size(), [&](int p)
+    {
+      long kk = todo[p];
+      double pt[3] = {region[0] + step[0] * (kk % (N+1)), region[2] + step[1] * ((kk / (N+1)) % (N+1)), region[4] + step[2] * (kk / ((N+1)*(N+1)))};
+      values[p] = DoseRate(model, src, pt, activity);
+    });
+    for (size_t p = 0; p < todo.size(); p++) dose[todo[p]] = values[p];
+
+    // refine cells whose centre is poorly predicted by their corners
+    vector<DoseCell> next;
+    for (size_t c = 0; c < active.size(); c++)
+    {
+      const DoseCell& cell = active[c];
+      long h = cell.size / 2;
+      double meanLog = 0.0;
+      for (int corner = 0; corner < 8; corner++)
+        meanLog += log(max(dose[key(cell.ijk[0] + (corner & 1) * cell.size, cell.ijk[1] + ((corner >> 1) & 1) * cell.size, cell.ijk[2] + ((corner >> 2) & 1) * cell.size)], 1e-300)) / 8;
+      double centreLog = log(max(dose[key(cell.ijk[0] + h, cell.ijk[1] + h, cell.ijk[2] + h)], 1e-300));
+      if (cell.depth < maxDepth && fabs(centreLog - meanLog) > tol)
+      {
+        for (int child = 0; child < 8; child++)
+          next.push_back(DoseCell{{cell.ijk[0] + (child & 1) * h, cell.ijk[1] + ((child >> 1) & 1) * h, cell.ijk[2] + ((child >> 2) & 1) * h}, h, cell.depth + 1});
+      }
+      else leaves.push_back(cell);
+    }
+    active = next;
+  }
+
+  ofstream out(fileName);
+  if (!out.is_open()) {cout << "Error: Dose map file not open" << endl; exit(EXIT_FAILURE);}
+  for (size_t c = 0; c < leaves.size(); c++)
+  {
+    const DoseCell& cell = leaves[c];
+    long h = cell.size / 2;
+    out << region[0] + step[0] * (cell.ijk[0] + h) << " " << region[2] + step[1] * (cell.ijk[1] + h) << " "
+        << region[4] + step[2] * (cell.ijk[2] + h) << " " << step[0] * cell.size << " " << step[1] * cell.size << " "
+        << step[2] * cell.size << " " << dose[key(cell.ijk[0] + h, cell.ijk[1] + h, cell.ijk[2] + h)] << endl;
+  }
+  out.close();
+
+  double uniform = pow((double)(n0 << maxDepth) + 1, 3) + pow((double)(n0 << maxDepth), 3);
+  cout << "  " << leaves.size() << " cells from " << dose.size() << " point evaluations (uniform grid at the finest level: "
+       << uniform << "), written to " << fileName << endl;
+}
@@ -0,0 +1,163 @@
+/*******
+* Geometry.hh
+*   Nested-shell geometry for CalcAtten: shielding layers wrapped around a cylindrical or box-shaped cavity.
+*
+* Dependencies:
+*   CalcAtten.hh: Layer, SplitArgs(), LoadMaterial() and MuRho()
+*
+* Conventions:
+*   cyl bodies have dims (radius, height), box bodies have dims (x, y, z) as full side lengths, all in cm
+*   layers are listed innermost first; each layer grows the body by its thickness on every side
+*   bodies are centred on the origin, with the cylinder axis along z
+*   dose is the uncollided air kerma, from the mass energy-absorption coefficients of Data/AirData.txt
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+struct Body
+{
+  string shape; // "cyl" or "box"
+  double dims[3]; // cm
+};
+
+Body ParseCavity(string args)
+{
+  /*******
+  * Parse the arguments of a Cavity(shape,cm): command, e.g. "cyl,15,30" or "box,20,20,30"
+  *******/
+
+  vector<string> f = SplitArgs(args);
+  Body b;
+  b.shape = f[0];
+  b.dims[0] = b.dims[1] = b.dims[2] = 0.0;
+  if (b.shape == "cyl" && f.size() == 3) {b.dims[0] = stod(f[1]); b.dims[1] = stod(f[2]);}
+  else if (b.shape == "box" && f.size() == 4) {b.dims[0] = stod(f[1]); b.dims[1] = stod(f[2]); b.dims[2] = stod(f[3]);}
+  else {cout << "Error: Cavity expects cyl,r,h or box,x,y,z" << endl; exit(EXIT_FAILURE);}
+  return b;
+}
+
+Body Grow(const Body& b, double t)
+{
+  /*******
+  * Return the body enclosing b with a wall of thickness t (cm) on every side
+  *******/
+
+  Body g = b;
+  if (b.shape == "cyl") {g.dims[0] += t; g.dims[1] += 2*t;}
+  else {g.dims[0] += 2*t; g.dims[1] += 2*t; g.dims[2] += 2*t;}
+  return g;
+}
+
+double Volume(const Body& b)
+{
+  /*******
+  * Return the volume (cm^3) of the body
+  *******/
+
+  if (b.shape == "cyl") return M_PI * b.dims[0] * b.dims[0] * b.dims[1];
+  return b.dims[0] * b.dims[1] * b.dims[2];
+}
+
+double Footprint(const Body& b)
+{
+  /*******
+  * Return the floor area (cm^2) taken up by the body
+  *******/
+
+  if (b.shape == "cyl") return M_PI * b.dims[0] * b.dims[0];
+  return b.dims[0] * b.dims[1];
+}
+
+double ChordLength(const Body& b, const double* p0, const double* p1)
+{
+  /*******
+  * Return the length (cm) of the segment p0-p1 that lies inside body b, centred on the origin (cyl axis along z)
+  *******/
+
+  double d[3] = {p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2]};
+  double s0 = 0.0, s1 = 1.0; // segment parameter range inside the body
+
+  // clip against the slabs |x_i| <= half-width, for the box in x, y, z and for the cylinder in z
+  for (int i = (b.shape == "cyl" ? 2 : 0); i < 3; i++)
+  {
+    double half = 0.5 * (b.shape == "cyl" ? b.dims[1] : b.dims[i]);
+    if (d[i] == 0.0) {if (fabs(p0[i]) > half) return 0.0; continue;}
+    double sa = (-half - p0[i]) / d[i], sb = (half - p0[i]) / d[i];
+    s0 = max(s0, min(sa, sb));
+    s1 = min(s1, max(sa, sb));
+  }
+
+  // clip against the cylinder wall x^2 + y^2 <= r^2
+  if (b.shape == "cyl")
+  {
+    double r = b.dims[0];
+    double a = d[0]*d[0] + d[1]*d[1], bq = 2*(p0[0]*d[0] + p0[1]*d[1]), c = p0[0]*p0[0] + p0[1]*p0[1] - r*r;
+    if (a == 0.0) {if (c > 0) return 0.0;}
+    else
+    {
+      double disc = bq*bq - 4*a*c;
+      if (disc <= 0) return 0.0;
+      s0 = max(s0, (-bq - sqrt(disc)) / (2*a));
+      s1 = min(s1, (-bq + sqrt(disc)) / (2*a));
+    }
+  }
+
+  return s1 > s0 ? (s1 - s0) * sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]) : 0.0;
+}
+
+struct ShieldModel
+{
+  vector<Body> bodies; // bodies[0] is the cavity, bodies[i] the outside of layer i
+  vector<double> mu; // linear attenuation coefficient (1/cm) of layer i+1 at the model energy
+  double E; // keV
+  double kermaPerFluence; // air kerma per unit photon fluence at E (Gy cm^2)
+};
+
+ShieldModel MakeShieldModel(const Body& cavity, const vector<Layer>& stack, double E)
+{
+  /*******
+  * Nest the layers of stack around cavity and tabulate what point evaluations at energy E (keV) need
+  * Loads the materials, so call before any ParallelFor()
+  *******/
+
+  ShieldModel model;
+  model.E = E;
+  model.bodies.push_back(cavity);
+  for (size_t i = 0; i < stack.size(); i++)
+  {
+    model.bodies.push_back(Grow(model.bodies.back(), stack[i].thickness));
+    model.mu.push_back(MuRho(LoadMaterial(stack[i].absorber), E));
+  }
+  Material& air = LoadMaterial("Air");
+  model.kermaPerFluence = (E/1000.) * 1.602176634e-13 * LogLogInterp(air.Es, air.MEACs, E/1000.) * 1000.; // MeV * J/MeV * cm^2/g * g/kg
+  return model;
+}
+
+double ShieldTransmit(const ShieldModel& model, const double* src, const double* pt)
+{
+  /*******
+  * Return the uncollided transmission along the ray from src to pt through the nested layers
+  *******/
+
+  double tau = 0.0, inner = ChordLength(model.bodies[0], src, pt);
+  for (size_t i = 0; i < model.mu.size(); i++)
+  {
+    double outer = ChordLength(model.bodies[i+1], src, pt);
+    tau += model.mu[i] * (outer - inner);
+    inner = outer;
+  }
+  return exp(-tau);
+}
+
+double DoseRate(const ShieldModel& model, const double* src, const double* pt, double activity)
+{
+  /*******
+  * Return the uncollided air kerma rate (Gy/h) at pt from an isotropic point source at src
+  * emitting activity (photons/s) at the model energy
+  *******/
+
+  double r2 = (pt[0]-src[0])*(pt[0]-src[0]) + (pt[1]-src[1])*(pt[1]-src[1]) + (pt[2]-src[2])*(pt[2]-src[2]);
+  r2 = max(r2, 1e-6); // keep the source point itself finite
+  return activity / (4 * M_PI * r2) * ShieldTransmit(model, src, pt) * model.kermaPerFluence * 3600.;
+}
@@ -0,0 +1,227 @@
+/*******
+* Hypercube.hh
+*   Precomputed transmission tables for a family of stacks, answered by multilinear interpolation.
+*
+* Dependencies:
+*   CalcAtten.hh: LoadMaterial(), MuRho() and ParallelFor()
+*
+* Description:
+*   A family is a fixed list of layers (axes), each with a thickness range [0, tMax].
+*   ln(T) is tabulated on a tensor grid over (E, t_1 ... t_k) and written to a file that is memory-mapped back,
+*   so a query touches only the 2^(k+1) surrounding grid points.
+*   The energy axis is log-spaced, with every absorption edge in range inserted twice (just below and at the edge),
+*   so interpolation never straddles an edge.
+*   Narrow-beam ln(T) is linear in each thickness, so the thickness axes interpolate exactly; the error comes from
+*   the energy axis and is estimated per energy cell as sum_i t_i * max|mu_i - interpolated mu_i|, with the max
+*   taken over 7 energies sampled inside each cell when the table is built; it is an estimate, not a bound, since
+*   the tables can bend between the samples.
+*
+* File layout:
+*   HypercubeHeader, energies[nE] (keV), muErr[nE-1][k] (1/cm), lnT[nE][nt]...[nt]
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <cstring> // memset() and strncpy() for the file header
+#include <fcntl.h> // open() for mapping the table
+#include <unistd.h> // close()
+#include <sys/mman.h> // mmap() and munmap()
+#include <sys/stat.h> // fstat() for the mapped file size
+
+const int HYPERCUBE_MAXAXES = 6;
+
+struct HypercubeHeader
+{
+  char magic[8]; // "CAHCUBE1"
+  int k; // number of thickness axes
+  int nE; // energy grid points
+  int nt; // grid points per thickness axis
+  int pad;
+  double tMax[HYPERCUBE_MAXAXES]; // cm
+  char names[HYPERCUBE_MAXAXES][16]; // absorber of each axis
+};
+
+struct Hypercube
+{
+  const HypercubeHeader* header;
+  const double* energies;
+  const double* muErr;
+  const double* lnT;
+  size_t stride[HYPERCUBE_MAXAXES + 1]; // elements per step along energy, t_1, ..., t_k
+  void* map;
+  size_t mapSize;
+};
+
+void BuildHypercube(string fileName, const vector<Layer>& axes, double Emin, double Emax, int nE, int nt)
+{
+  /*******
+  * Tabulate ln(T) for the family described by axes (absorber, tMax) and write it to fileName
+  *******/
+
+  int k = axes.size();
+  if (k < 1 || k > HYPERCUBE_MAXAXES) {cout << "Error: Hypercube needs 1 to " << HYPERCUBE_MAXAXES << " axes" << endl; exit(EXIT_FAILURE);}
+  if (nE < 2 || nt < 2 || Emin <= 0 || Emax <= Emin) {cout << "Error: Bad hypercube grid" << endl; exit(EXIT_FAILURE);}
+
+  // energy nodes: log-spaced grid plus the edges of every axis material, each edge once just below and once at the edge
+  vector<const Material*> mats;
+  vector<double> energies;
+  for (int i = 0; i < nE; i++) energies.push_back(Emin * pow(Emax/Emin, i/(nE - 1.)));
+  for (int a = 0; a < k; a++)
+  {
+    mats.push_back(&LoadMaterial(axes[a].absorber));
+    const vector<double>& Es = mats[a]->Es;
+    for (size_t j = 1; j < Es.size(); j++)
+    {
+      double edge = Es[j] * 1000.; // MeV to keV
+      if (Es[j] == Es[j-1] && edge > Emin && edge < Emax) {energies.push_back(edge * (1 - 1e-9)); energies.push_back(edge);}
+    }
+  }
+  sort(energies.begin(), energies.end());
+  nE = energies.size();
+
+  // linear attenuation coefficients at the nodes, and the estimated interpolation error inside each energy cell
+  vector<double> mu(nE * k), muErr((nE - 1) * k, 0.0);
+  for (int e = 0; e < nE; e++) for (int a = 0; a < k; a++) mu[e*k + a] = MuRho(*mats[a], energies[e]);
+  for (int e = 0; e + 1 < nE; e++)
+  {
+    for (int s = 1; s < 8; s++)
+    {
+      double f = s / 8.;
+      double E = energies[e] * pow(energies[e+1]/energies[e], f);
+      for (int a = 0; a < k; a++)
+      {
+        double interp = mu[e*k + a] + f * (mu[(e+1)*k + a] - mu[e*k + a]);
+        muErr[e*k + a] = max(muErr[e*k + a], fabs(MuRho(*mats[a], E) - interp));
+      }
+    }
+  }
+
+  // ln(T) on the tensor grid, one energy slice per parallel iteration
+  size_t slice = 1;
+  for (int a = 0; a < k; a++) slice *= nt;
+  vector<double> lnT(nE * slice);
+  ParallelFor(nE, [&](int e)
+  {
+    for (size_t j = 0; j < slice; j++)
+    {
+      size_t rem = j;
+      double tau = 0.0;
+      for (int a = k - 1; a >= 0; a--)
+      {
+        tau += mu[e*k + a] * axes[a].thickness * (rem % nt) / (nt - 1.);
+        rem /= nt;
+      }
+      lnT[e*slice + j] = -tau;
+    }
+  });
+
+  HypercubeHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "CAHCUBE1", 8);
+  header.k = k;
+  header.nE = nE;
+  header.nt = nt;
+  for (int a = 0; a < k; a++)
+  {
+    header.tMax[a] = axes[a].thickness;
+    strncpy(header.names[a], axes[a].absorber.c_str(), 15);
+  }
+
+  ofstream out(fileName, ios::binary);
+  if (!out.is_open()) {cout << "Error: Hypercube file not open" << endl; exit(EXIT_FAILURE);}
+  out.write((const char*)&header, sizeof(header));
+  out.write((const char*)&energies[0], nE * sizeof(double));
+  out.write((const char*)&muErr[0], muErr.size() * sizeof(double));
+  out.write((const char*)&lnT[0], lnT.size() * sizeof(double));
+  out.close();
+  if (!out) {cout << "Error: Could not write hypercube" << endl; exit(EXIT_FAILURE);}
+  cout << "  Wrote " << nE << " energies x " << slice << " thickness points to " << fileName << endl;
+}
+
+Hypercube OpenHypercube(string fileName)
+{
+  /*******
+  * Memory-map a table written by BuildHypercube()
+  *******/
+
+  Hypercube hc;
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {cout << "Error: Hypercube file not open" << endl; exit(EXIT_FAILURE);}
+  struct stat st;
+  fstat(fd, &st);
+  hc.mapSize = st.st_size;
+  hc.map = mmap(NULL, hc.mapSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (hc.map == MAP_FAILED || hc.mapSize < sizeof(HypercubeHeader)) {cout << "Error: Could not map hypercube file" << endl; exit(EXIT_FAILURE);}
+
+  hc.header = (const HypercubeHeader*)hc.map;
+  if (memcmp(hc.header->magic, "CAHCUBE1", 8) != 0) {cout << "Error: Not a hypercube file" << endl; exit(EXIT_FAILURE);}
+  int k = hc.header->k, nE = hc.header->nE, nt = hc.header->nt;
+  if (k < 1 || k > HYPERCUBE_MAXAXES || nE < 2 || nt < 2) {cout << "Error: Bad hypercube header" << endl; exit(EXIT_FAILURE);}
+
+  // count the doubles the header implies, stopping as soon as they could not fit in the file
+  size_t room = (hc.mapSize - sizeof(HypercubeHeader)) / sizeof(double);
+  size_t need = (size_t)nE + (size_t)(nE - 1) * k;
+  hc.stride[k] = 1;
+  for (int a = k - 1; a >= 0 && need <= room; a--)
+    hc.stride[a] = (hc.stride[a+1] > room / nt) ? room + 1 : hc.stride[a+1] * nt;
+  if (need > room || hc.stride[0] > (room - need) / nE) {cout << "Error: Truncated hypercube file" << endl; exit(EXIT_FAILURE);}
+  hc.energies = (const double*)((const char*)hc.map + sizeof(HypercubeHeader));
+  hc.muErr = hc.energies + nE;
+  hc.lnT = hc.muErr + (nE - 1) * k;
+  return hc;
+}
+
+void CloseHypercube(Hypercube& hc)
+{
+  munmap(hc.map, hc.mapSize);
+  hc.map = NULL;
+}
+
+double QueryHypercube(const Hypercube& hc, double E, const double* t, double* errEstimate)
+{
+  /*******
+  * Return T interpolated at energy E (keV) and thicknesses t[0..k-1] (cm)
+  * If errEstimate is given, it receives the estimate of |ln T - interpolated ln T| (see the header of this file)
+  * Out-of-range queries are clamped to the table
+  *******/
+
+  int k = hc.header->k, nE = hc.header->nE, nt = hc.header->nt;
+
+  // energy cell [e, e+1) and fraction, interpolating in ln(E)
+  int e = upper_bound(hc.energies, hc.energies + nE, E) - hc.energies - 1;
+  e = min(max(e, 0), nE - 2);
+  double fE = log(E / hc.energies[e]) / log(hc.energies[e+1] / hc.energies[e]);
+  fE = min(max(fE, 0.0), 1.0);
+
+  // thickness cells on the uniform grids
+  int cell[HYPERCUBE_MAXAXES];
+  double frac[HYPERCUBE_MAXAXES];
+  double estimate = 0.0;
+  for (int a = 0; a < k; a++)
+  {
+    double x = min(max(t[a] / hc.header->tMax[a], 0.0), 1.0) * (nt - 1);
+    cell[a] = min((int)x, nt - 2);
+    frac[a] = x - cell[a];
+    estimate += min(max(t[a], 0.0), hc.header->tMax[a]) * hc.muErr[e*k + a];
+  }
+  if (errEstimate) *errEstimate = estimate;
+
+  // sum over the 2^(k+1) corners of the cell
+  double lnT = 0.0;
+  const double* base = hc.lnT + e * hc.stride[0];
+  for (int c = 0; c < (2 << k); c++)
+  {
+    double w = (c & 1) ? fE : 1 - fE;
+    size_t off = (c & 1) * hc.stride[0];
+    for (int a = 0; a < k; a++)
+    {
+      int bit = (c >> (a + 1)) & 1;
+      w *= bit ? frac[a] : 1 - frac[a];
+      off += (cell[a] + bit) * hc.stride[a+1];
+    }
+    if (w != 0.0) lnT += w * base[off];
+  }
+  return exp(lnT);
+}
@@ -0,0 +1,137 @@
+/*******
+* Identify.hh
+*   Material identification: the material and thickness that best explain transmissions measured at a few energies.
+*
+* Dependencies:
+*   CalcAtten.hh: Material, LoadMaterial(), MuRho(), ParallelFor() and numThreads
+*   Table.hh: ParamTable, ReadParamTable(), CloseParamTable() and TABLE_CHUNK
+*
+* Input:
+*   a parameter table (CSV or mapped binary, as for --table), one row per pixel or measurement, its columns the
+*   transmissions at the energies given to Identify, in that order; the column names are not used
+*   candidates: the IdentifyMaterials list, or else every material with a file in Data/, the same set whether the
+*   run is direct or a fork of a zygote that has preloaded more; MaterialDB materials are candidates only when
+*   listed
+*
+* Method:
+*   with y_k = -ln T_k and kappa_mk the mass attenuation coefficient of material m at energy k, a layer of m of
+*   areal density a (g/cm^2) predicts y = a kappa_m; the least-squares a for m is (y . kappa_m) / |kappa_m|^2,
+*   with residual |y|^2 - (y . u_m)^2 for the unit vector u_m = kappa_m / |kappa_m|, so the best material is the
+*   one whose u_m has the largest y . u_m (a >= 0): one dot product per candidate per row, no iterations
+*   the coefficients are looked up once, before the rows; rows are fitted in chunks of TABLE_CHUNK, in parallel,
+*   and written in row order, as table runs are
+*   the data files carry no atomic numbers, so a pixel is identified by the nearest library material (its
+*   direction in coefficient space, the dual-energy ratio for two energies) rather than by an effective Z
+*   transmissions at or below 0 are taken as IDENTIFY_MIN_T
+*
+* Output:
+*   "row material g/cm^2 cm rms" per row, rms the root-mean-square residual in ln T; "none" for a row with
+*   T = 1 at every energy (nothing in the beam)
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+const double IDENTIFY_MIN_T = 1e-30;
+
+struct IdentifyLibrary
+{
+  vector<const Material*> mats;
+  int nE;
+  vector<double> unit; // [material][energy]: kappa_m / |kappa_m|
+  vector<double> norm; // |kappa_m| (cm^2/g)
+};
+
+IdentifyLibrary BuildIdentifyLibrary(const vector<string>& candidates, const vector<double>& energies)
+{
+  /*******
+  * Look up the candidates' mass attenuation coefficients at the energies (keV)
+  *******/
+
+  IdentifyLibrary lib;
+  lib.nE = energies.size();
+  for (size_t m = 0; m < candidates.size(); m++)
+  {
+    const Material& mat = LoadMaterial(candidates[m]);
+    lib.mats.push_back(&mat);
+    double sum = 0.0;
+    vector<double> kappa(lib.nE);
+    for (int k = 0; k < lib.nE; k++) {kappa[k] = MuRho(mat, energies[k]) / mat.density; sum += kappa[k] * kappa[k];}
+    lib.norm.push_back(sqrt(sum));
+    for (int k = 0; k < lib.nE; k++) lib.unit.push_back(kappa[k] / lib.norm.back());
+  }
+  return lib;
+}
+
+int IdentifyRow(const IdentifyLibrary& lib, const double* T, double& areal, double& rms)
+{
+  /*******
+  * Best material (index into lib.mats, or -1 for an empty beam) for the transmissions T; see the header
+  *******/
+
+  double y[PARAM_MAXCOLS], yy = 0.0;
+  for (int k = 0; k < lib.nE; k++) {y[k] = -log(max(T[k], IDENTIFY_MIN_T)); yy += y[k] * y[k];}
+  int best = -1;
+  double bestDot = 0.0;
+  for (size_t m = 0; m < lib.mats.size(); m++)
+  {
+    const double* u = &lib.unit[m * lib.nE];
+    double dot = 0.0;
+    for (int k = 0; k < lib.nE; k++) dot += y[k] * u[k];
+    if (dot > bestDot) {bestDot = dot; best = m;}
+  }
+  areal = (best >= 0) ? bestDot / lib.norm[best] : 0.0;
+  rms = sqrt(max(0.0, yy - bestDot * bestDot) / lib.nE);
+  return best;
+}
+
+void IdentifyTable(const vector<string>& candidates, const vector<double>& energies, string tableFile, string outFile)
+{
+  /*******
+  * Fit every row of tableFile and write "row material g/cm^2 cm rms" per row to outFile
+  *******/
+
+  IdentifyLibrary lib = BuildIdentifyLibrary(candidates, energies);
+  ParamTable pt = ReadParamTable(tableFile);
+  long nCols = pt.names.size();
+  if (nCols != lib.nE) {cout << "Error: Identify table has " << nCols << " columns for " << lib.nE << " energies" << endl; exit(EXIT_FAILURE);}
+  cout << "Identifying " << pt.nRows << " rows at " << lib.nE << " energies among " << lib.mats.size() << " materials" << endl;
+
+  ofstream out(outFile);
+  if (!out.is_open()) {cout << "Error: Identify output not open" << endl; exit(EXIT_FAILURE);}
+  long nChunks = (pt.nRows + TABLE_CHUNK - 1) / TABLE_CHUNK;
+  long perRound = 4 * max(1, numThreads > 0 ? numThreads : (int)thread::hardware_concurrency());
+  vector<string> text(perRound);
+  vector<long> counts(lib.mats.size() + 1, 0);
+  vector<vector<long> > roundCounts(perRound, vector<long>(lib.mats.size() + 1));
+  for (long c0 = 0; c0 < nChunks; c0 += perRound)
+  {
+    long nRound = min(perRound, nChunks - c0);
+    ParallelFor(nRound, [&](int k)
+    {
+      long r0 = (c0 + k) * TABLE_CHUNK, n = min(TABLE_CHUNK, pt.nRows - r0);
+      string& s = text[k];
+      s.clear();
+      fill(roundCounts[k].begin(), roundCounts[k].end(), 0);
+      char buf[128];
+      for (long r = 0; r < n; r++)
+      {
+        double areal, rms;
+        int m = IdentifyRow(lib, pt.rows + (r0 + r) * nCols, areal, rms);
+        roundCounts[k][m + 1]++;
+        const char* name = (m >= 0) ? lib.mats[m]->name.c_str() : "none";
+        double cm = (m >= 0) ? areal / lib.mats[m]->density : 0.0;
+        s.append(buf, snprintf(buf, sizeof(buf), "%ld %s %.6g %.6g %.3g\n", r0 + r, name, areal, cm, rms));
+      }
+    });
+    for (long k = 0; k < nRound; k++)
+    {
+      out.write(text[k].data(), text[k].size());
+      for (size_t m = 0; m < counts.size(); m++) counts[m] += roundCounts[k][m];
+    }
+  }
+  CloseParamTable(pt);
+
+  for (size_t m = 0; m < lib.mats.size(); m++) if (counts[m + 1] > 0) cout << "  " << lib.mats[m]->name << ": " << counts[m + 1] << " rows" << endl;
+  if (counts[0] > 0) cout << "  none: " << counts[0] << " rows" << endl;
+}
@@ -0,0 +1,319 @@
+/*******
+* Import.hh
+*   Bulk import of external photon cross-section tables into a packed binary material database for CalcAtten.
+*
+* Dependencies:
+*   CalcAtten.hh: Material, materialCache, DataFileTable, dataFileCache, SplitArgs() and ParallelFor()
+*
+* Manifest:
+*   one material per line, "name format file density(g/cm^3) [Z/A(mol/g)]"; blank lines and lines starting with # are skipped
+*   Z/A is needed only by the scattering modes
+*   formats:
+*     calcatten: the Data/<absorber>Data.txt format (density and Z/A are taken from the file if the manifest gives 0)
+*     nist:      NIST XrayMassCoef tables 3/4, "[edge] E(MeV) mu/rho mu_en/rho" per line
+*     xcom:      NIST XCOM output, "[edge] E(MeV) coh incoh photo pairN pairE tot_coh tot_nocoh" (cm^2/g) per line
+*     epdl:      EPDL97 ASCII tables for one element; integrated cross sections (I=0) of reactions C=71-75 are summed
+*   XCOM and EPDL carry no energy-absorption coefficient; mu_en/rho is approximated by the total without coherent
+*   scattering, which overestimates it wherever Compton scattering matters.
+*
+* Database layout:
+*   "CAMATDB2", int32 count, then per material: char name[32], double density, double Z/A, int32 n, Es[n], MACs[n], MEACs[n]
+*
+* Ref:
+*   https://physics.nist.gov/PhysRefData/Xcom/html/xcom1.html
+*   D. E. Cullen et al., "EPDL97: the Evaluated Photon Data Library, '97 Version", UCRL-50400 Vol. 6 Rev. 5 (1997)
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <cstring> // memcpy() and strncpy() for the packed records
+
+struct ImportEntry
+{
+  string name;
+  string format;
+  string file;
+  double density;
+  double ZoverA;
+  Material mat; // filled by the parser
+  string error; // empty on success
+};
+
+bool ParseNumber(string s, double& x)
+{
+  /*******
+  * Parse a number, also accepting the Fortran/ENDF form without an exponent letter, e.g. "1.2345-3"
+  *******/
+
+  while (!s.empty() && s[0] == ' ') s.erase(0, 1);
+  while (!s.empty() && s[s.size()-1] == ' ') s.erase(s.size()-1);
+  if (s.empty()) return false;
+  for (size_t i = 1; i < s.size(); i++)
+    if ((s[i] == '+' || s[i] == '-') && s[i-1] != 'E' && s[i-1] != 'e') {s.insert(i, "E"); break;}
+  char* end;
+  x = strtod(s.c_str(), &end);
+  return *end == '\0' && isfinite(x);
+}
+
+vector<double> NumbersOnLine(string line)
+{
+  /*******
+  * Return the numeric fields of a whitespace-separated line, skipping a leading edge label such as "K" or "L1"
+  *******/
+
+  vector<double> xs;
+  istringstream iss(line);
+  string tok;
+  double x;
+  while (iss >> tok)
+  {
+    if (ParseNumber(tok, x)) xs.push_back(x);
+    else if (!xs.empty()) return vector<double>(); // text after numbers: not a data line
+  }
+  return xs;
+}
+
+void ParseTabulated(ImportEntry& entry)
+{
+  /*******
+  * Parse the line-oriented formats (calcatten, nist, xcom) into entry.mat
+  *******/
+
+  ifstream in(entry.file);
+  if (!in.is_open()) {entry.error = "file not open"; return;}
+  string line;
+  while (getline(in, line))
+  {
+    if (entry.format == "calcatten")
+    {
+      string::size_type n = line.find(" ");
+      if (n == string::npos) continue;
+      string lineType = line.substr(0, n);
+      if (lineType == "Density(g/cm^3):" && entry.density <= 0) ParseNumber(line.substr(n+1), entry.density);
+      if (lineType == "Z/A(mol/g):" && entry.ZoverA <= 0) ParseNumber(line.substr(n+1), entry.ZoverA);
+      if (lineType != "MAC(MeV,cm^2/g,cm^2/g):") continue;
+      line = line.substr(n+1);
+    }
+    vector<double> xs = NumbersOnLine(line);
+    if (entry.format == "xcom" && xs.size() >= 8)
+    {
+      entry.mat.Es.push_back(xs[0]);
+      entry.mat.MACs.push_back(xs[6]);
+      entry.mat.MEACs.push_back(xs[7]);
+    }
+    else if (entry.format != "xcom" && xs.size() >= 3)
+    {
+      entry.mat.Es.push_back(xs[0]);
+      entry.mat.MACs.push_back(xs[1]);
+      entry.mat.MEACs.push_back(xs[2]);
+    }
+  }
+}
+
+void ParseEPDL(ImportEntry& entry)
+{
+  /*******
+  * Parse an EPDL97 file into entry.mat, summing coherent, incoherent, photoelectric and pair cross sections
+  * Each table is two header lines (Z, A, Yi, Yo, AW...; C, I, S, X1) then "E sigma" lines, ended by a 1 in column 72
+  *******/
+
+  ifstream in(entry.file);
+  if (!in.is_open()) {entry.error = "file not open"; return;}
+
+  vector<vector<double> > tableEs, tableXs; // per reaction: energies (MeV) and cross sections (b)
+  vector<bool> coherent;
+  double atomicWeight = 0.0;
+  string line1, line2, line;
+  while (getline(in, line1))
+  {
+    if (line1.find_first_not_of(" \r") == string::npos) continue;
+    if (!getline(in, line2)) {entry.error = "truncated table header"; return;}
+    double aw = 0.0;
+    if (line1.size() >= 24) ParseNumber(line1.substr(13, 11), aw);
+    int C = atoi(line2.substr(0, 2).c_str());
+    int I = line2.size() >= 5 ? atoi(line2.substr(2, 3).c_str()) : -1;
+    bool keep = (C >= 71 && C <= 75 && I == 0);
+    if (keep && aw > 0) atomicWeight = aw;
+    vector<double> Es, Xs;
+    while (getline(in, line))
+    {
+      if (line.size() >= 72 && line[71] == '1') break;
+      double e, x;
+      if (keep && line.size() >= 22 && ParseNumber(line.substr(0, 11), e) && ParseNumber(line.substr(11, 11), x)) {Es.push_back(e); Xs.push_back(x);}
+    }
+    if (keep && !Es.empty()) {tableEs.push_back(Es); tableXs.push_back(Xs); coherent.push_back(C == 71);}
+  }
+  if (tableEs.empty()) {entry.error = "no integrated photon cross sections (C=71-75, I=0)"; return;}
+  if (atomicWeight <= 0) {entry.error = "no atomic weight in table headers"; return;}
+
+  // union of all reaction energies (keeping edge pairs), and the summed cross section on it
+  vector<double> grid;
+  for (size_t r = 0; r < tableEs.size(); r++) grid.insert(grid.end(), tableEs[r].begin(), tableEs[r].end());
+  sort(grid.begin(), grid.end());
+  vector<double> Es;
+  for (size_t i = 0; i < grid.size(); i++)
+    if (Es.size() < 2 || grid[i] != Es[Es.size()-1] || grid[i] != Es[Es.size()-2]) Es.push_back(grid[i]);
+  double perBarn = 1e-24 * 6.02214076e23 / atomicWeight; // b/atom to cm^2/g
+  for (size_t i = 0; i < Es.size(); i++)
+  {
+    bool above = (i > 0 && Es[i] == Es[i-1]); // second copy of an edge energy takes the value above the edge
+    double total = 0.0, noCoherent = 0.0;
+    for (size_t r = 0; r < tableEs.size(); r++)
+    {
+      const vector<double>& te = tableEs[r];
+      if (Es[i] < te.front() || Es[i] > te.back()) continue; // reaction below its threshold
+      size_t j = above ? upper_bound(te.begin(), te.end(), Es[i]) - te.begin() - 1
+                       : lower_bound(te.begin(), te.end(), Es[i]) - te.begin();
+      double x = (te[j] == Es[i] || j == 0) ? tableXs[r][j]
+               : exp(log(tableXs[r][j-1]) + log(Es[i]/te[j-1]) / log(te[j]/te[j-1]) * (log(tableXs[r][j]) - log(tableXs[r][j-1])));
+      total += x;
+      if (!coherent[r]) noCoherent += x;
+    }
+    entry.mat.Es.push_back(Es[i]);
+    entry.mat.MACs.push_back(total * perBarn);
+    entry.mat.MEACs.push_back(noCoherent * perBarn);
+  }
+}
+
+void ValidateMaterial(ImportEntry& entry)
+{
+  /*******
+  * Check the parsed tables: positive density, at least two points, non-decreasing energies with at most
+  * two entries per energy (absorption edges), and positive coefficients
+  *******/
+
+  const Material& m = entry.mat;
+  if (!entry.error.empty()) return;
+  if (!(entry.density > 0)) {entry.error = "no positive density"; return;}
+  if (m.Es.size() < 2) {entry.error = "fewer than two data points"; return;}
+  for (size_t i = 0; i < m.Es.size(); i++)
+  {
+    if (!(m.Es[i] > 0 && m.MACs[i] > 0 && m.MEACs[i] > 0)) {entry.error = "non-positive value at line " + to_string(i+1); return;}
+    if (i > 0 && m.Es[i] < m.Es[i-1]) {entry.error = "energies not sorted at line " + to_string(i+1); return;}
+    if (i > 1 && m.Es[i] == m.Es[i-1] && m.Es[i] == m.Es[i-2]) {entry.error = "energy repeated three times at line " + to_string(i+1); return;}
+  }
+}
+
+vector<ImportEntry> ReadManifest(string manifestName)
+{
+  /*******
+  * Read the import manifest; see the header of this file for its format
+  *******/
+
+  ifstream in(manifestName);
+  if (!in.is_open()) {cout << "Error: Import manifest not open" << endl; exit(EXIT_FAILURE);}
+  vector<ImportEntry> entries;
+  string line;
+  while (getline(in, line))
+  {
+    if (line.empty() || line[0] == '#') continue;
+    istringstream iss(line);
+    ImportEntry entry;
+    if (!(iss >> entry.name >> entry.format >> entry.file >> entry.density)) {cout << "Error: Bad manifest line: " << line << endl; exit(EXIT_FAILURE);}
+    if (!(iss >> entry.ZoverA)) entry.ZoverA = 0.0;
+    if (entry.name.size() > 31) {cout << "Error: Material name too long: " << entry.name << endl; exit(EXIT_FAILURE);}
+    entries.push_back(entry);
+  }
+  return entries;
+}
+
+void WriteMaterialDB(string dbName, const vector<ImportEntry>& entries)
+{
+  /*******
+  * Write the parsed materials, sorted by name, as a packed database
+  *******/
+
+  vector<const ImportEntry*> sorted;
+  for (size_t i = 0; i < entries.size(); i++) sorted.push_back(&entries[i]);
+  sort(sorted.begin(), sorted.end(), [](const ImportEntry* a, const ImportEntry* b) {return a->name < b->name;});
+
+  ofstream out(dbName, ios::binary);
+  if (!out.is_open()) {cout << "Error: Material database not open for writing" << endl; exit(EXIT_FAILURE);}
+  int count = sorted.size();
+  out.write("CAMATDB2", 8);
+  out.write((const char*)&count, sizeof(count));
+  for (size_t i = 0; i < sorted.size(); i++)
+  {
+    const Material& m = sorted[i]->mat;
+    char name[32] = {0};
+    strncpy(name, sorted[i]->name.c_str(), 31);
+    int n = m.Es.size();
+    out.write(name, 32);
+    out.write((const char*)&sorted[i]->density, sizeof(double));
+    out.write((const char*)&sorted[i]->ZoverA, sizeof(double));
+    out.write((const char*)&n, sizeof(n));
+    out.write((const char*)&m.Es[0], n * sizeof(double));
+    out.write((const char*)&m.MACs[0], n * sizeof(double));
+    out.write((const char*)&m.MEACs[0], n * sizeof(double));
+  }
+}
+
+void ImportMaterials(string manifestName, string dbName)
+{
+  /*******
+  * Parse and validate every manifest entry in parallel, then write the packed database
+  * Any invalid entry aborts the import after all entries have been reported
+  *******/
+
+  vector<ImportEntry> entries = ReadManifest(manifestName);
+  ParallelFor(entries.size(), [&](int i)
+  {
+    ImportEntry& entry = entries[i];
+    if (entry.format == "epdl") ParseEPDL(entry);
+    else if (entry.format == "calcatten" || entry.format == "nist" || entry.format == "xcom") ParseTabulated(entry);
+    else entry.error = "unknown format " + entry.format;
+    entry.mat.name = entry.name;
+    entry.mat.density = entry.density;
+    entry.mat.ZoverA = entry.ZoverA;
+    ValidateMaterial(entry);
+  });
+
+  int nBad = 0;
+  for (size_t i = 0; i < entries.size(); i++)
+    if (!entries[i].error.empty()) {cout << "  Error importing " << entries[i].name << " from " << entries[i].file << ": " << entries[i].error << endl; nBad++;}
+  if (nBad > 0) {cout << "Error: " << nBad << " of " << entries.size() << " materials failed to import" << endl; exit(EXIT_FAILURE);}
+
+  WriteMaterialDB(dbName, entries);
+  cout << "  Imported " << entries.size() << " materials into " << dbName << endl;
+}
+
+void LoadMaterialDB(string dbName)
+{
+  /*******
+  * Load every material of a packed database into the material cache, ahead of the Data/ text files
+  * Each also goes into dataFileCache, so that Shield, which reads through Density() and MassAttenCoeff(), can
+  * use it as a layer like any other material
+  *******/
+
+  ifstream in(dbName, ios::binary);
+  if (!in.is_open()) {cout << "Error: Material database not open" << endl; exit(EXIT_FAILURE);}
+  char magic[8];
+  int count = 0;
+  in.read(magic, 8);
+  in.read((char*)&count, sizeof(count));
+  if (!in || memcmp(magic, "CAMATDB2", 8) != 0) {cout << "Error: Not a material database" << endl; exit(EXIT_FAILURE);}
+  for (int i = 0; i < count; i++)
+  {
+    char name[32];
+    Material m;
+    int n = 0;
+    in.read(name, 32);
+    in.read((char*)&m.density, sizeof(double));
+    in.read((char*)&m.ZoverA, sizeof(double));
+    in.read((char*)&n, sizeof(n));
+    if (!in || n < 2) {cout << "Error: Truncated material database" << endl; exit(EXIT_FAILURE);}
+    name[31] = '\0';
+    m.name = name;
+    m.Es.resize(n);
+    m.MACs.resize(n);
+    m.MEACs.resize(n);
+    in.read((char*)&m.Es[0], n * sizeof(double));
+    in.read((char*)&m.MACs[0], n * sizeof(double));
+    in.read((char*)&m.MEACs[0], n * sizeof(double));
+    if (!in) {cout << "Error: Truncated material database" << endl; exit(EXIT_FAILURE);}
+    materialCache[m.name] = m;
+    dataFileCache[m.name] = DataFileTable{m.density, m.Es, m.MACs};
+  }
+  cout << "  Loaded " << count << " materials from " << dbName << endl;
+}
@@ -0,0 +1,251 @@
+/*******
+* Pareto.hh
+*   Multi-objective (NSGA-II) search over nested-shell shield designs for CalcAtten.
+*
+* Dependencies:
+*   CalcAtten.hh: LoadMaterial(), MuRho() and ParallelFor()
+*   Geometry.hh: Body, Grow(), Volume() and Footprint()
+*
+* Objectives, all minimised:
+*   0: worst transmission over the target lines, kept as log10(T) so that crowding works across decades
+*   1: total mass of the shells (kg)
+*   2: outer footprint (cm^2)
+*
+* Ref:
+*   K. Deb et al., "A fast and elitist multiobjective genetic algorithm: NSGA-II", IEEE Trans. Evol. Comp. 6 (2002) 182
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <random> // mt19937 and distributions for the genetic operators
+
+struct ParetoConfig
+{
+  vector<string> materials; // candidate absorbers
+  vector<double> targets; // target gamma lines (keV)
+  Body cavity; // innermost (empty) body
+  int nLayers; // layers per design; zero-thickness layers drop out
+  double tMax; // maximum thickness of one layer (cm)
+  int popSize;
+  int nGens;
+  unsigned seed;
+};
+
+struct Design
+{
+  vector<int> mats; // index into ParetoConfig::materials, innermost layer first
+  vector<double> ts; // thicknesses (cm)
+  double obj[3];
+  int rank;
+  double crowd;
+};
+
+void EvaluateDesign(Design& d, const ParetoConfig& cfg, const vector<vector<double> >& mu, const vector<double>& rho)
+{
+  /*******
+  * Fill in the objectives of d
+  * mu[m][k] = linear attenuation coefficient (1/cm) of material m at target k, rho[m] = density (g/cm^3)
+  *******/
+
+  double worst = -1e300, mass = 0.0;
+  for (size_t k = 0; k < cfg.targets.size(); k++)
+  {
+    double tau = 0.0;
+    for (int l = 0; l < cfg.nLayers; l++) tau += mu[d.mats[l]][k] * d.ts[l];
+    worst = max(worst, -tau / log(10.));
+  }
+  Body b = cfg.cavity;
+  for (int l = 0; l < cfg.nLayers; l++)
+  {
+    Body outer = Grow(b, d.ts[l]);
+    mass += rho[d.mats[l]] * (Volume(outer) - Volume(b)) / 1000.; // g to kg
+    b = outer;
+  }
+  d.obj[0] = worst;
+  d.obj[1] = mass;
+  d.obj[2] = Footprint(b);
+}
+
+bool Dominates(const Design& a, const Design& b)
+{
+  /*******
+  * Return true if a is no worse than b in every objective and better in at least one
+  *******/
+
+  bool better = false;
+  for (int j = 0; j < 3; j++)
+  {
+    if (a.obj[j] > b.obj[j]) return false;
+    if (a.obj[j] < b.obj[j]) better = true;
+  }
+  return better;
+}
+
+vector<vector<int> > NonDominatedSort(vector<Design>& pop)
+{
+  /*******
+  * Sort pop into Pareto fronts (fast non-dominated sort), set each design's rank, and return the fronts as indices
+  *******/
+
+  int n = pop.size();
+  vector<vector<int> > dominated(n), fronts(1);
+  vector<int> count(n, 0);
+  for (int p = 0; p < n; p++)
+  {
+    for (int q = 0; q < n; q++)
+    {
+      if (Dominates(pop[p], pop[q])) dominated[p].push_back(q);
+      else if (Dominates(pop[q], pop[p])) count[p]++;
+    }
+    if (count[p] == 0) {pop[p].rank = 0; fronts[0].push_back(p);}
+  }
+  for (size_t f = 0; !fronts[f].empty(); f++)
+  {
+    vector<int> next;
+    for (size_t i = 0; i < fronts[f].size(); i++)
+    {
+      int p = fronts[f][i];
+      for (size_t j = 0; j < dominated[p].size(); j++)
+      {
+        int q = dominated[p][j];
+        if (--count[q] == 0) {pop[q].rank = f + 1; next.push_back(q);}
+      }
+    }
+    fronts.push_back(next);
+  }
+  fronts.pop_back(); // last front is always empty
+  return fronts;
+}
+
+void CrowdingDistance(vector<Design>& pop, const vector<int>& front)
+{
+  /*******
+  * Set the crowding distance of every design in front; boundary designs get an infinite distance
+  *******/
+
+  for (size_t i = 0; i < front.size(); i++) pop[front[i]].crowd = 0.0;
+  vector<int> idx = front;
+  for (int j = 0; j < 3; j++)
+  {
+    sort(idx.begin(), idx.end(), [&](int a, int b) {return pop[a].obj[j] < pop[b].obj[j];});
+    double lo = pop[idx.front()].obj[j], hi = pop[idx.back()].obj[j];
+    pop[idx.front()].crowd = pop[idx.back()].crowd = 1e300;
+    if (hi <= lo) continue;
+    for (size_t i = 1; i + 1 < idx.size(); i++)
+      pop[idx[i]].crowd += (pop[idx[i+1]].obj[j] - pop[idx[i-1]].obj[j]) / (hi - lo);
+  }
+}
+
+vector<Design> ParetoSearch(const ParetoConfig& cfg)
+{
+  /*******
+  * Run NSGA-II and return the final Pareto front, sorted by mass
+  * Offspring are bred serially from a seeded generator and evaluated in parallel, so results do not depend on thread count
+  *******/
+
+  // tabulate everything the evaluation needs, so the parallel part never touches the material cache
+  int nMats = cfg.materials.size();
+  vector<vector<double> > mu(nMats, vector<double>(cfg.targets.size()));
+  vector<double> rho(nMats);
+  for (int m = 0; m < nMats; m++)
+  {
+    Material& mat = LoadMaterial(cfg.materials[m]);
+    rho[m] = mat.density;
+    for (size_t k = 0; k < cfg.targets.size(); k++) mu[m][k] = MuRho(mat, cfg.targets[k]);
+  }
+
+  mt19937 rng(cfg.seed);
+  uniform_real_distribution<double> unif(0.0, 1.0);
+  uniform_int_distribution<int> pickMat(0, nMats - 1), pickLayer(0, cfg.nLayers - 1), pickParent(0, cfg.popSize - 1);
+  normal_distribution<double> jitter(0.0, 0.1 * cfg.tMax);
+
+  // random initial population
+  vector<Design> pop(cfg.popSize);
+  for (int i = 0; i < cfg.popSize; i++)
+  {
+    pop[i].mats.resize(cfg.nLayers);
+    pop[i].ts.resize(cfg.nLayers);
+    for (int l = 0; l < cfg.nLayers; l++) {pop[i].mats[l] = pickMat(rng); pop[i].ts[l] = cfg.tMax * unif(rng);}
+  }
+  ParallelFor(cfg.popSize, [&](int i) {EvaluateDesign(pop[i], cfg, mu, rho);});
+  vector<vector<int> > fronts = NonDominatedSort(pop);
+  for (size_t f = 0; f < fronts.size(); f++) CrowdingDistance(pop, fronts[f]);
+
+  for (int gen = 0; gen < cfg.nGens; gen++)
+  {
+    // breed offspring by binary tournament, uniform crossover and mutation
+    vector<Design> kids(cfg.popSize);
+    for (int i = 0; i < cfg.popSize; i++)
+    {
+      const Design* parent[2];
+      for (int p = 0; p < 2; p++)
+      {
+        const Design& a = pop[pickParent(rng)];
+        const Design& b = pop[pickParent(rng)];
+        parent[p] = (a.rank < b.rank || (a.rank == b.rank && a.crowd > b.crowd)) ? &a : &b;
+      }
+      Design& kid = kids[i];
+      kid.mats.resize(cfg.nLayers);
+      kid.ts.resize(cfg.nLayers);
+      for (int l = 0; l < cfg.nLayers; l++)
+      {
+        const Design* src = parent[unif(rng) < 0.5 ? 0 : 1];
+        kid.mats[l] = src->mats[l];
+        kid.ts[l] = src->ts[l];
+        if (unif(rng) < 1.0 / cfg.nLayers) kid.mats[l] = pickMat(rng);
+        if (unif(rng) < 1.0 / cfg.nLayers) kid.ts[l] = min(cfg.tMax, max(0.0, kid.ts[l] + jitter(rng)));
+      }
+      if (cfg.nLayers > 1 && unif(rng) < 0.1) // reorder two layers
+      {
+        int a = pickLayer(rng), b = pickLayer(rng);
+        swap(kid.mats[a], kid.mats[b]);
+        swap(kid.ts[a], kid.ts[b]);
+      }
+    }
+    ParallelFor(cfg.popSize, [&](int i) {EvaluateDesign(kids[i], cfg, mu, rho);});
+
+    // elitist selection from parents and offspring together
+    pop.insert(pop.end(), kids.begin(), kids.end());
+    fronts = NonDominatedSort(pop);
+    vector<Design> next;
+    for (size_t f = 0; f < fronts.size() && (int)next.size() < cfg.popSize; f++)
+    {
+      CrowdingDistance(pop, fronts[f]);
+      vector<int> front = fronts[f];
+      if ((int)(next.size() + front.size()) > cfg.popSize)
+        sort(front.begin(), front.end(), [&](int a, int b) {return pop[a].crowd > pop[b].crowd;});
+      for (size_t i = 0; i < front.size() && (int)next.size() < cfg.popSize; i++) next.push_back(pop[front[i]]);
+    }
+    pop = next;
+  }
+
+  // return the first front, sorted by mass, dropping designs that duplicate another's objectives
+  vector<Design> front;
+  for (size_t i = 0; i < pop.size(); i++) if (pop[i].rank == 0) front.push_back(pop[i]);
+  sort(front.begin(), front.end(), [](const Design& a, const Design& b) {return a.obj[1] < b.obj[1];});
+  vector<Design> unique;
+  for (size_t i = 0; i < front.size(); i++)
+  {
+    const Design* last = unique.empty() ? NULL : &unique.back();
+    if (last && last->obj[0] == front[i].obj[0] && last->obj[1] == front[i].obj[1] && last->obj[2] == front[i].obj[2]) continue;
+    unique.push_back(front[i]);
+  }
+  return unique;
+}
+
+void PrintParetoFront(const vector<Design>& front, const ParetoConfig& cfg)
+{
+  /*******
+  * Print one line per design: worst transmission, mass, footprint, then the layers from the inside out
+  *******/
+
+  cout << "  Pareto front: " << front.size() << " designs (worst T, mass kg, footprint cm^2, layers inside out)" << endl;
+  for (size_t i = 0; i < front.size(); i++)
+  {
+    cout << "  " << pow(10., front[i].obj[0]) << " " << front[i].obj[1] << " " << front[i].obj[2] << " ";
+    for (int l = 0; l < cfg.nLayers; l++)
+      if (front[i].ts[l] > 0) cout << " " << cfg.materials[front[i].mats[l]] << "," << front[i].ts[l];
+    cout << endl;
+  }
+}
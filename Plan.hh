@@ -0,0 +1,445 @@
+/*******
+* Plan.hh
+*   Dry-run planner: what a macro or table job would do, and roughly how long and how much memory it would take.
+*
+* Dependencies:
+*   CalcAtten.hh: Layer, DataFileAbsorbers(), LoadMaterial(), Density(), ReadDataFileMACs(), dataFileCache, MuRho(),
+*   SplitArgs() and numThreads
+*   Import.hh: LoadMaterialDB()
+*   Snapshot.hh: RestoreSnapshot()
+*   Tables.hh: PackTables() and unionReplicas
+*   Geometry.hh, Scatter.hh, Collapse.hh, SN.hh, Batch.hh, Sweep.hh, Table.hh, Transport.hh, Adjoint.hh, Unfold.hh,
+*   Identify.hh: the kernels timed
+*   Shard.hh: numWorkers
+*
+* Use:
+*   ./CalcAtten macro.txt --plan
+*   ./CalcAtten macro.txt --table rows.csv results.txt --plan   (the table is read, to size it)
+*
+* Method:
+*   the macro is read as the run would read it, keeping the energy, stack and settings, but only set-up commands
+*   (Threads:, MaterialDB(file):, PackTables(numa):, Restore(file):) are carried out; nothing is written
+*   each command is costed by running its own kernel on a small sample of its work with the same stack and
+*   settings (PLAN_SAMPLES energies or rows, PLAN_HISTORIES histories, a coarse SingleScatter or SN grid,
+*   PLAN_UNFOLD_ITERATIONS MLEM iterations on the real response),
+*   and scaling the time by the full work; memory is the size of the command's large arrays
+*   adaptive commands (SweepAdaptive, DoseMap) are costed at their expected or largest size, as marked; SN is
+*   scaled from a few groups, since its cost grows with the groups; Trajectory and Import are not costed
+*   workers on the same machine share its cores, so times are not divided by Workers
+*
+* Output:
+*   one line per command (line number, work, kernel path, time, memory), the materials to load, the totals,
+*   and a last line "PLAN key=value ..." for schedulers and admission control
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <set> // distinct materials
+#include <iomanip> // setw() for the plan table
+
+const long PLAN_SAMPLES = 20000;
+const long PLAN_HISTORIES = 20000;
+const int PLAN_UNFOLD_ITERATIONS = 20;
+const double PLAN_ADAPTIVE_POINTS = 26; // SweepAdaptive points per decade at tol 1, growing as 1/sqrt(tol)
+
+struct PlanItem
+{
+  int line;
+  string command;
+  string work;
+  string path;
+  double seconds; // < 0 if not estimated
+  double megabytes; // < 0 if not estimated
+  bool bound; // seconds and megabytes are upper bounds
+};
+
+struct Plan
+{
+  vector<PlanItem> items;
+  set<string> materials;
+  double layerEvaluations, energies, histories;
+
+  Plan() : layerEvaluations(0), energies(0), histories(0) {}
+};
+
+double TimeIt(function<void()> f)
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  f();
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+string PlanCount(double n)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), n < 1e6 ? "%.0f" : "%.3g", n);
+  return buf;
+}
+
+string TablePath(const vector<Layer>& stack)
+{
+  /*******
+  * Which coefficient path StackLookup will take for stack
+  *******/
+
+  if (unionReplicas.empty()) return "per-material tables";
+  for (size_t i = 0; i < stack.size(); i++)
+    if (find(unionNames.begin(), unionNames.end(), stack[i].absorber) == unionNames.end()) return "packed tables, some layers per-material";
+  return unionReplicas.size() > 1 ? "packed tables per NUMA node" : "packed tables";
+}
+
+double SweepSeconds(const vector<Layer>& stack, double E1, double E2, long n)
+{
+  /*******
+  * Time PLAN_SAMPLES sweep energies over [E1, E2], evaluated and formatted as the output is, and scale to n
+  *******/
+
+  StackLookup lookup(stack);
+  vector<double> mu(stack.size());
+  long m = min(n, PLAN_SAMPLES);
+  string text;
+  double t = TimeIt([&]()
+  {
+    char buf[64];
+    for (long i = 0; i < m; i++)
+    {
+      double Ei = E1 * pow(E2 / E1, (double)i / max(1L, m - 1));
+      text.append(buf, snprintf(buf, sizeof(buf), "%.10g %.10g\n", Ei, SweepPointT(lookup, stack, Ei, mu)));
+    }
+    ofstream("/dev/null").write(text.data(), text.size());
+  });
+  return t * n / m;
+}
+
+void PlanMacro(string macroFileName)
+{
+  /*******
+  * Read a macro without running it and print its plan; see the header of this file
+  *******/
+
+  ifstream ifs(macroFileName);
+  if (!ifs.is_open()) {cout << "Error: Macro file not open" << endl; exit(EXIT_FAILURE);}
+  Plan plan;
+  double E = 0.0;
+  vector<Layer> stack, hypercubeAxes;
+  vector<string> paretoMaterials, identifyMaterials;
+  WeightSpectrum snWeight;
+  bool snCollapse = false;
+  int nTargets = 0;
+  Body cavity = ParseCavity("cyl,10,20");
+  unsigned long seed = 12345;
+  bool eventBased = true, deltaTracking = false, diffuseBeam = false;
+  int tallyBins = 100;
+  string sweepPlotFile;
+  int workers = numWorkers;
+  numWorkers = 0; // calibration runs in this process
+  map<string, double> shieldCost; // seconds per Shield of each absorber
+
+  string line;
+  int lineNo = 0;
+  while (getline(ifs, line))
+  {
+    lineNo++;
+    string::size_type n = line.find(" ");
+    if (n == string::npos) {cout << "Error: Unexpected macro format" << endl; exit(EXIT_FAILURE);}
+    string cmdType = line.substr(0, n), cmdArg = line.substr(n+1);
+    vector<string> args = SplitArgs(cmdArg);
+    PlanItem item = {lineNo, cmdType.substr(0, cmdType.find_first_of("(:")), "", "", -1.0, -1.0, false};
+
+    if (cmdType == "Gamma(keV):") E = stod(cmdArg);
+    else if (cmdType == "Threads:") numThreads = stoi(cmdArg);
+    else if (cmdType == "Workers:") workers = stoi(cmdArg);
+    else if (cmdType == "Seed:") seed = stoul(cmdArg);
+    else if (cmdType == "TransportMode:") eventBased = (cmdArg == "event");
+    else if (cmdType == "Tracking:") deltaTracking = (cmdArg == "delta");
+    else if (cmdType == "Beam:") diffuseBeam = (cmdArg == "diffuse");
+    else if (cmdType == "Tallies(file,bins,batches):" && args.size() == 3) tallyBins = stoi(args[1]);
+    else if (cmdType == "SweepPlot(file,mode,buckets):" && args.size() == 3) sweepPlotFile = (args[1] == "off") ? "" : args[0];
+    else if (cmdType == "Target(keV):") nTargets++;
+    else if (cmdType == "Cavity(shape,cm):") cavity = ParseCavity(cmdArg);
+    else if (cmdType == "ParetoMaterials:") paretoMaterials = args;
+    else if (cmdType == "IdentifyMaterials:") identifyMaterials = args;
+    else if (cmdType == "SNWeight:") {snCollapse = (cmdArg != "midpoint"); if (snCollapse) snWeight = ReadWeightSpectrum(cmdArg);}
+    else if (cmdType == "Collapse(file,groups,keV,keV,weight):" && args.size() == 5 && !stack.empty())
+    {
+      int G = stoi(args[1]);
+      WeightSpectrum ws = ReadWeightSpectrum(args[4]);
+      vector<double> Eb = LogGroups(stod(args[2]), stod(args[3]), G);
+      size_t cached = collapseCache.size();
+      item.seconds = TimeIt([&]() {for (size_t l = 0; l < stack.size(); l++) CollapseMaterial(LoadMaterial(stack[l].absorber), Eb, ws);});
+      item.work = to_string(G) + " groups x " + to_string(collapseCache.size() - cached) + " new materials";
+      item.path = "cached collapse";
+      item.megabytes = 0;
+      for (size_t l = 0; l < stack.size(); l++) plan.materials.insert(stack[l].absorber);
+    }
+    else if (cmdType == "HypercubeAxis(type,cm):" && args.size() == 2) hypercubeAxes.push_back(Layer{args[0], stod(args[1])});
+    else if (cmdType == "MaterialDB(file):")
+    {
+      item.work = "load " + cmdArg;
+      item.seconds = TimeIt([&]() {LoadMaterialDB(cmdArg);});
+      item.path = "packed database";
+    }
+    else if (cmdType == "Restore(file):")
+    {
+      item.work = "restore " + cmdArg;
+      item.seconds = TimeIt([&]() {RestoreSnapshot(cmdArg);});
+      item.path = unionReplicas.empty() ? "snapshot, no tables" : "snapshot, tables mapped";
+    }
+    else if (cmdType == "Snapshot(file):") {item.work = "save " + cmdArg; item.path = "not estimated";}
+    else if (cmdType == "PackTables(numa):")
+    {
+      item.seconds = TimeIt([&]() {PackTables(cmdArg == "on");});
+      item.work = to_string(unionNames.size()) + " materials";
+      item.path = cmdArg == "on" ? "one copy per NUMA node" : "one copy";
+      item.megabytes = unionReplicas.empty() ? 0 : unionReplicas.size() * unionReplicas[0].bytes / 1e6;
+    }
+    else if (cmdType == "Shield(type,cm):" && args.size() == 2)
+    {
+      // the legacy path reads the data file twice per layer, unless the table is already in memory
+      bool inMemory = dataFileCache.count(args[0]);
+      if (!shieldCost.count(args[0]))
+      {
+        vector<double> Es, MACs;
+        shieldCost[args[0]] = inMemory ? TimeIt([&]() {Density(args[0]);}) : TimeIt([&]() {Density(args[0]); ReadDataFileMACs(args[0], Es, MACs);});
+      }
+      stack.push_back(Layer{args[0], stod(args[1])});
+      plan.materials.insert(args[0]);
+      plan.layerEvaluations++;
+      item.work = "1 layer of " + args[0];
+      item.path = inMemory ? "in-memory table" : "data file read";
+      item.seconds = shieldCost[args[0]];
+    }
+    else if (cmdType == "Sweep(file,keV,keV,n):" && args.size() == 4)
+    {
+      long nE = (long)stod(args[3]);
+      StackLookup lookup(stack);
+      long nEdges = SweepEdges(lookup, stod(args[1]), stod(args[2])).size();
+      item.work = PlanCount(nE + 2 * nEdges) + " energies x " + to_string(stack.size()) + " layers";
+      item.path = TablePath(stack) + ", chunks of " + to_string(SWEEP_CHUNK) + (sweepPlotFile.empty() ? "" : ", downsampled") + (workers > 0 ? ", " + to_string(workers) + " workers" : "");
+      item.seconds = SweepSeconds(stack, stod(args[1]), stod(args[2]), nE + 2 * nEdges);
+      long perRound = workers > 0 ? 1 : 4 * max(1, numThreads > 0 ? numThreads : (int)thread::hardware_concurrency());
+      item.megabytes = min(nE, perRound * SWEEP_CHUNK) * (sizeof(SweepPoint) + 24) / 1e6;
+      plan.energies += nE + 2 * nEdges;
+      plan.layerEvaluations += (nE + 2 * nEdges) * (double)stack.size();
+    }
+    else if (cmdType == "SweepAdaptive(file,keV,keV,tol):" && args.size() == 4)
+    {
+      double decades = log10(stod(args[2]) / stod(args[1]));
+      StackLookup lookup(stack);
+      long nE = SweepEdges(lookup, stod(args[1]), stod(args[2])).size() * 2 + SWEEP_ADAPTIVE_PER_DECADE * decades
+                + PLAN_ADAPTIVE_POINTS * decades / sqrt(stod(args[3]));
+      for (size_t i = 0; i < lookup.mats.size(); i++) nE += lookup.mats[i]->Es.size();
+      item.work = "about " + PlanCount(nE) + " energies x " + to_string(stack.size()) + " layers";
+      item.path = TablePath(stack) + ", bisection";
+      item.seconds = SweepSeconds(stack, stod(args[1]), stod(args[2]), nE);
+      item.megabytes = 0;
+      plan.energies += nE;
+      plan.layerEvaluations += nE * (double)stack.size();
+    }
+    else if (cmdType == "Unfold(file,out,fwhm,iters):" && args.size() == 4)
+    {
+      vector<double> Es, measured;
+      ReadMeasuredSpectrum(args[0], Es, measured);
+      UnfoldResponse r = BuildResponse(stack, Es, stod(args[2]));
+      int iters = stoi(args[3]), m = min(iters, PLAN_UNFOLD_ITERATIONS);
+      double t = TimeIt([&]() {MlemUnfold(r, measured, m);});
+      item.work = to_string(iters) + " iterations x " + to_string(r.n) + " channels";
+      item.path = "MLEM, " + PlanCount(r.colVal.size()) + " response entries";
+      item.seconds = t * iters / m;
+      item.megabytes = (r.colVal.size() * (2 * sizeof(double) + sizeof(int)) + r.n * 12 * sizeof(double)) / 1e6;
+      plan.energies += r.n;
+      plan.layerEvaluations += r.n * (double)stack.size();
+    }
+    else if (cmdType == "Identify(file,out,keV...):" && args.size() >= 4 && args.size() - 2 <= (size_t)PARAM_MAXCOLS)
+    {
+      vector<double> energies;
+      for (size_t a = 2; a < args.size(); a++) energies.push_back(stod(args[a]));
+      vector<string> candidates = identifyMaterials.empty() ? DataFileAbsorbers() : identifyMaterials;
+      for (size_t m = 0; m < candidates.size(); m++) plan.materials.insert(candidates[m]);
+      IdentifyLibrary lib = BuildIdentifyLibrary(candidates, energies);
+      ParamTable pt = ReadParamTable(args[0]);
+      long m = min(pt.nRows, PLAN_SAMPLES);
+      double sink = 0.0;
+      double t = ((long)pt.names.size() != lib.nE) ? 0.0 : TimeIt([&]()
+      {
+        char buf[128];
+        for (long r = 0; r < m; r++)
+        {
+          double areal, rms;
+          int best = IdentifyRow(lib, pt.rows + r * lib.nE, areal, rms);
+          sink += snprintf(buf, sizeof(buf), "%ld %d %.6g %.6g %.3g\n", r, best, areal, areal, rms);
+        }
+      });
+      if (sink < 0) cout << sink;
+      item.work = PlanCount(pt.nRows) + " rows x " + to_string(energies.size()) + " energies x " + to_string(candidates.size()) + " materials";
+      item.path = "closed-form fits, chunks of " + to_string(TABLE_CHUNK);
+      item.seconds = (m > 0) ? t * pt.nRows / m / max(1, numThreads > 0 ? numThreads : (int)thread::hardware_concurrency()) : 0;
+      item.megabytes = (pt.map ? 0 : pt.storage.size() * sizeof(double) / 1e6) + 4 * max(1, numThreads > 0 ? numThreads : (int)thread::hardware_concurrency()) * TABLE_CHUNK * 48 / 1e6;
+      CloseParamTable(pt);
+      plan.energies += energies.size();
+      plan.layerEvaluations += energies.size() * (double)candidates.size();
+    }
+    else if (cmdType == "StackBatch(file,out,keV...):" && args.size() >= 3)
+    {
+      vector<vector<Layer> > stacks = ReadStacks(args[0]);
+      vector<double> energies;
+      for (size_t a = 2; a < args.size(); a++) energies.push_back(stod(args[a]));
+      double layers = 0;
+      for (size_t s = 0; s < stacks.size(); s++) {layers += stacks[s].size(); for (size_t l = 0; l < stacks[s].size(); l++) plan.materials.insert(stacks[s][l].absorber);}
+      vector<vector<Layer> > sample(stacks.begin(), stacks.begin() + min(stacks.size(), (size_t)PLAN_SAMPLES));
+      StackBatch b = PackStacks(sample);
+      double t = TimeIt([&]() {BatchTransmit(b, energies);});
+      item.work = PlanCount(stacks.size()) + " stacks x " + to_string(energies.size()) + " energies";
+      item.path = to_string(BATCH_LANES) + "-lane blocks" + (workers > 0 ? ", " + to_string(workers) + " workers" : "");
+      item.seconds = sample.empty() ? 0 : t * stacks.size() / sample.size();
+      item.megabytes = (stacks.size() * energies.size() * sizeof(double) + layers * (sizeof(LayerLanes) / BATCH_LANES + sizeof(Layer))) / 1e6;
+      plan.energies += energies.size();
+      plan.layerEvaluations += layers * energies.size();
+    }
+    else if ((cmdType == "Transport(histories,keV):" || cmdType == "Adjoint(histories,keV):") && args.size() == 2 && !stack.empty())
+    {
+      long h = (long)stod(args[0]);
+      bool adjoint = (cmdType[0] == 'A');
+      TransportConfig tc = {E, stod(args[1]), min(h, PLAN_HISTORIES), seed, eventBased, deltaTracking, diffuseBeam, tallyBins, 0};
+      AdjointConfig ac = {E, stod(args[1]), min(h, PLAN_HISTORIES), seed};
+      double t;
+      if (adjoint) RunAdjoint(stack, ac, t);
+      else RunTransport(stack, tc, t);
+      item.work = PlanCount(h) + " histories through " + to_string(stack.size()) + " layers";
+      if (adjoint) item.path = "adjoint, weight window";
+      else item.path = string(eventBased ? "event" : "history") + ", " + (deltaTracking ? "delta" : "surface") + " tracking" + (eventBased && !deltaTracking ? ", energy-sorted lookups" : "");
+      item.path += ", " + TablePath(stack) + (workers > 0 && !adjoint ? ", " + to_string(workers) + " workers" : "");
+      item.seconds = t * h / tc.histories;
+      int threads = numThreads > 0 ? numThreads : thread::hardware_concurrency();
+      double round = min((double)TALLY_ROUND, ceil((double)h / TRANSPORT_BATCH));
+      item.megabytes = (threads * TRANSPORT_BATCH * (6 * sizeof(double) + sizeof(int) + 2)
+                        + (adjoint ? 0 : round * (stack.size() + 3 * tallyBins) * 2 * sizeof(double))) / 1e6;
+      for (size_t l = 0; l < stack.size(); l++) plan.materials.insert(stack[l].absorber);
+      plan.histories += h;
+    }
+    else if (cmdType == "HypercubeBuild(file,keV,keV,nE,nt):" && args.size() == 5)
+    {
+      double points = stod(args[3]);
+      for (size_t a = 0; a < hypercubeAxes.size(); a++) {points *= stod(args[4]); plan.materials.insert(hypercubeAxes[a].absorber);}
+      // one multiply-add per axis and grid point
+      vector<double> x(PLAN_SAMPLES, 1.0);
+      double t = TimeIt([&]() {double s = 0.0; for (long i = 0; i < PLAN_SAMPLES; i++) s += x[i] * 0.5 * (i % 7); x[0] = s;});
+      item.work = PlanCount(points) + " grid points x " + to_string(hypercubeAxes.size()) + " axes";
+      item.path = "tensor grid, memory-mapped file";
+      item.seconds = t * points * hypercubeAxes.size() / PLAN_SAMPLES;
+      item.megabytes = 2 * points * sizeof(double) / 1e6;
+      plan.layerEvaluations += stod(args[3]) * hypercubeAxes.size();
+    }
+    else if (cmdType == "DoseMap(file,n0,depth,tol):" && args.size() == 4 && !stack.empty())
+    {
+      double side = stod(args[1]) * pow(2.0, stod(args[2])) + 1, points = side * side * side;
+      ShieldModel model = MakeShieldModel(cavity, stack, E);
+      double src[3] = {0, 0, 0}, sink = 0.0;
+      double t = TimeIt([&]() {for (long i = 0; i < PLAN_SAMPLES / 10; i++) {double pt[3] = {50.0 + i % 17, 30.0 - i % 13, 10.0 + i % 11}; sink += DoseRate(model, src, pt, 1.0);}});
+      if (sink < 0) cout << sink;
+      item.work = "at most " + PlanCount(points) + " points";
+      item.path = "octree, lattice cache";
+      item.seconds = t * points / (PLAN_SAMPLES / 10);
+      item.megabytes = points * 64 / 1e6;
+      item.bound = true;
+      plan.layerEvaluations += points * stack.size();
+    }
+    else if (cmdType == "Pareto(layers,cm,pop,gens):" && args.size() == 4 && !paretoMaterials.empty())
+    {
+      double evals = stod(args[2]) * (stod(args[3]) + 1) * max(1, nTargets), layers = stod(args[0]);
+      for (size_t m = 0; m < paretoMaterials.size(); m++) plan.materials.insert(paretoMaterials[m]);
+      const Material& mat = LoadMaterial(paretoMaterials[0]);
+      double sink = 0.0;
+      double t = TimeIt([&]() {for (long i = 0; i < PLAN_SAMPLES; i++) sink += MuRho(mat, 50.0 + i % 3000);});
+      if (sink < 0) cout << sink;
+      item.work = PlanCount(evals) + " designs x " + args[0] + " layers";
+      item.path = "NSGA-II";
+      item.seconds = t * evals * layers / PLAN_SAMPLES;
+      item.megabytes = 0;
+      plan.layerEvaluations += evals * layers;
+    }
+    else if (cmdType == "SingleScatter(cm,cm,nz,nr):" && args.size() == 4 && !stack.empty())
+    {
+      int nz = stoi(args[2]), nr = stoi(args[3]), nz0 = min(nz, 8), nr0 = min(nr, 8);
+      double t = TimeIt([&]() {SingleScatter(stack, E, stod(args[0]), stod(args[1]), nz0, nr0);});
+      item.work = PlanCount((double)nz * nr) + " scatter cells x " + to_string(stack.size()) + " layers";
+      item.path = "quadrature";
+      item.seconds = t * nz * nr / (nz0 * nr0);
+      item.megabytes = 0;
+      for (size_t l = 0; l < stack.size(); l++) plan.materials.insert(stack[l].absorber);
+    }
+    else if (cmdType == "SN(order,groups,keV):" && args.size() == 3 && !stack.empty())
+    {
+      int order = stoi(args[0]), G = stoi(args[1]), G0 = min(G, 4);
+      double t = TimeIt([&]()
+      {
+        Multigroup mg = BuildMultigroup(stack, E, stod(args[2]), G0, min(order - 1, 8), snCollapse ? &snWeight : NULL);
+        SolveSN(stack, mg, E, order, 20000);
+      });
+      item.work = to_string(G) + " groups x S" + to_string(order) + " x " + to_string(stack.size()) + " layers";
+      item.path = "discrete ordinates";
+      item.seconds = t * G / G0;
+      for (size_t l = 0; l < stack.size(); l++) plan.materials.insert(stack[l].absorber);
+    }
+    else if (cmdType == "Trajectory(mode,tol):") {item.work = "adaptive"; item.path = "not estimated";}
+    else if (cmdType == "Import(manifest,db):") {item.work = "import " + args[0]; item.path = "not estimated";}
+    if (!item.work.empty()) plan.items.push_back(item);
+  }
+  numWorkers = workers;
+
+  // report
+  cout << "Plan for " << macroFileName << " (nothing run; times scaled from samples on this machine, "
+       << (numThreads > 0 ? numThreads : (int)thread::hardware_concurrency()) << " threads)" << endl;
+  double seconds = 0.0, peak = 0.0;
+  int unestimated = 0;
+  for (size_t i = 0; i < plan.items.size(); i++)
+  {
+    const PlanItem& it = plan.items[i];
+    cout << "  line " << setw(4) << it.line << "  " << setw(14) << left << it.command << right << "  " << it.work << "; " << it.path;
+    if (it.seconds >= 0) cout << "; " << (it.bound ? "<= " : "") << it.seconds << " s";
+    if (it.megabytes >= 0) cout << ", " << it.megabytes << " MB";
+    cout << endl;
+    if (it.seconds >= 0) seconds += it.seconds; else unestimated++;
+    peak = max(peak, it.megabytes);
+  }
+  double matMB = 0.0;
+  string names;
+  for (set<string>::iterator m = plan.materials.begin(); m != plan.materials.end(); m++)
+  {
+    names += (names.empty() ? "" : ", ") + *m;
+    map<string, Material>::iterator c = materialCache.find(*m);
+    if (c != materialCache.end()) matMB += c->second.Es.size() * 3 * sizeof(double) / 1e6;
+  }
+  cout << "  Materials to load: " << plan.materials.size() << (names.empty() ? "" : " (" + names + ")") << endl;
+  cout << "  Layer evaluations " << PlanCount(plan.layerEvaluations) << ", energies " << PlanCount(plan.energies) << ", histories " << PlanCount(plan.histories) << endl;
+  cout << "  Estimated " << seconds << " s, peak " << peak + matMB << " MB" << (unestimated ? " (" + to_string(unestimated) + " commands not estimated)" : "") << endl;
+  cout << "PLAN seconds=" << seconds << " memory_mb=" << peak + matMB << " materials=" << plan.materials.size()
+       << " layer_evaluations=" << plan.layerEvaluations << " energies=" << plan.energies << " histories=" << plan.histories
+       << " unestimated=" << unestimated << endl;
+}
+
+void PlanTable(string macroFileName, string tableFileName)
+{
+  /*******
+  * Plan a parameter-table run: compile the macro, size the table, and time the first rows
+  *******/
+
+  // the table is read (mapped, or parsed in parallel) to size it; that time is part of the estimate
+  CompiledMacro cm = CompileMacro(macroFileName);
+  ParamTable pt;
+  double readSeconds = TimeIt([&]() {pt = ReadParamTable(tableFileName);});
+  ParamTable sample = pt;
+  sample.nRows = min(pt.nRows, PLAN_SAMPLES);
+  double t = TimeIt([&]() {RunTable(cm, sample, "/dev/null");});
+  double seconds = readSeconds + (pt.nRows > 0 ? t * pt.nRows / sample.nRows : 0.0);
+  double layers = 0;
+  for (size_t s = 0; s < cm.steps.size(); s++) if (!cm.steps[s].gamma) layers++;
+  double megabytes = (pt.map ? 0.0 : pt.storage.size() * sizeof(double) / 1e6);
+  cout << "Plan for " << macroFileName << " over " << tableFileName << " (nothing run; time scaled from the first " << sample.nRows << " rows)" << endl;
+  cout << "  " << PlanCount(pt.nRows) << " rows x " << cm.steps.size() << " steps (" << layers << " layers), " << cm.params.size() << " parameters; "
+       << "compiled steps on " << TablePath(cm.layers) << ", chunks of " << TABLE_CHUNK << ", " << (pt.map ? "memory-mapped binary table" : "parsed CSV table") << endl;
+  cout << "  Estimated " << seconds << " s, " << megabytes << " MB" << endl;
+  cout << "PLAN seconds=" << seconds << " memory_mb=" << megabytes << " rows=" << pt.nRows << " layer_evaluations=" << pt.nRows * layers << endl;
+  CloseParamTable(pt);
+}
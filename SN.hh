@@ -0,0 +1,260 @@
+/*******
+* SN.hh
+*   Multigroup discrete-ordinates (S_N) transport for a beam normally incident on a slab stack.
+*
+* Dependencies:
+*   CalcAtten.hh: Layer, LoadMaterial(), MuRho() and ParallelFor()
+*   Scatter.hh: KleinNishina(), ComptonEnergy(), ElectronDensity() and GaussLegendre()
+*   Collapse.hh: CollapseMaterial() and WeightSpectrum
+*
+* Method:
+*   groups are log-spaced from just above the beam energy E0 down to Emin; photons scattered below Emin are lost
+*   total cross sections come from the loaded attenuation tables at each group's midpoint, or, with SNWeight
+*   set, are the tables collapsed over each group with that weight (cached, see Collapse.hh); scattering is
+*   Compton only (Klein-Nishina, free electrons), expanded in Legendre moments up to order L
+*   the uncollided beam is treated analytically and only its first-collision source enters the S_N sweeps,
+*   which avoids ray effects from the monodirectional beam; that source is integrated exactly over each
+*   ordinate's angular cell, since a Legendre series of the peaked single-scatter kernel goes negative
+*   each group is solved by source iteration with diamond-difference sweeps (negative fluxes set to zero),
+*   accelerated by rescaling the whole-slab group flux after every sweep so that leakage plus removal equals
+*   the group's fixed source (whole-slab rebalance);
+*   Compton only downscatters, so groups are solved once each from the top down
+*
+* Ref:
+*   E. E. Lewis and W. F. Miller, "Computational Methods of Neutron Transport", Wiley (1984), ch. 3-4
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+struct Multigroup
+{
+  int G; // groups, 0 is the highest
+  int L; // Legendre order of the scattering
+  vector<double> Eb; // group boundaries (keV), Eb[g] > Eb[g+1]
+  vector<double> Emid; // group midpoints (keV)
+  vector<vector<double> > sigt; // [layer][g] total (1/cm)
+  vector<vector<double> > sigs; // [layer][(l*G + from)*G + to] scattering moments (1/cm)
+  vector<double> ne; // [layer] electron density (1/cm^3)
+  vector<double> sigt0; // [layer] total at E0 (1/cm)
+};
+
+double Legendre(int l, double x)
+{
+  /*******
+  * Return the Legendre polynomial P_l(x)
+  *******/
+
+  double p0 = 1.0, p1 = x;
+  if (l == 0) return p0;
+  for (int j = 2; j <= l; j++) {double p2 = ((2*j - 1) * x * p1 - (j - 1) * p0) / j; p0 = p1; p1 = p2;}
+  return p1;
+}
+
+void ComptonMoments(double Ein, const vector<double>& Eb, int L, double ne, double* out)
+{
+  /*******
+  * Add to out[l*G + to] the Legendre moments of Compton scattering from energy Ein (keV) into each group
+  * out is per unit electron density times ne, i.e. in 1/cm
+  *******/
+
+  int G = Eb.size() - 1;
+  vector<double> x, w;
+  GaussLegendre(16, x, w);
+  for (int to = 0; to < G; to++)
+  {
+    // cos(theta) range sending Ein into [Eb[to+1], Eb[to]]
+    double cHi = min(1.0, 1 - ELECTRON_MASS_KEV * (1/min(Eb[to], Ein) - 1/Ein));
+    double cLo = max(-1.0, 1 - ELECTRON_MASS_KEV * (1/Eb[to+1] - 1/Ein));
+    if (Eb[to+1] >= Ein || cHi <= cLo) continue;
+    for (size_t q = 0; q < x.size(); q++)
+    {
+      double c = 0.5 * (cLo + cHi) + 0.5 * (cHi - cLo) * x[q];
+      double f = 2 * M_PI * ne * KleinNishina(Ein, c) * 0.5 * (cHi - cLo) * w[q];
+      for (int l = 0; l <= L; l++) out[l*G + to] += f * Legendre(l, c);
+    }
+  }
+}
+
+Multigroup BuildMultigroup(const vector<Layer>& stack, double E0, double Emin, int G, int L, const WeightSpectrum* weight = NULL)
+{
+  /*******
+  * Build group cross sections for every layer of stack, for a beam at E0 (keV) and groups down to Emin (keV)
+  * Totals are taken at the group midpoints, or collapsed with weight if it is given
+  *******/
+
+  Multigroup mg;
+  mg.G = G;
+  mg.L = L;
+  mg.Eb = LogGroups(E0 * 1.0001, Emin, G);
+  for (int g = 0; g < G; g++) mg.Emid.push_back(sqrt(mg.Eb[g] * mg.Eb[g+1]));
+  const int nSub = 4; // energies sampled per source group, equally weighted in ln(E)
+  for (size_t i = 0; i < stack.size(); i++)
+  {
+    const Material& mat = LoadMaterial(stack[i].absorber);
+    double ne = ElectronDensity(mat);
+    vector<double> st(G), ss((L+1) * G * G, 0.0);
+    const CollapsedGroups* cg = weight ? &CollapseMaterial(mat, mg.Eb, *weight) : NULL;
+    for (int g = 0; g < G; g++)
+    {
+      st[g] = cg ? cg->mu[g] * mat.density : MuRho(mat, mg.Emid[g]);
+      vector<double> tmp((L+1) * G, 0.0);
+      for (int k = 0; k < nSub; k++)
+        ComptonMoments(mg.Eb[g] * pow(mg.Eb[g+1] / mg.Eb[g], (k + 0.5) / nSub), mg.Eb, L, ne / nSub, &tmp[0]);
+      for (int l = 0; l <= L; l++) for (int to = 0; to < G; to++) ss[(l*G + g)*G + to] = tmp[l*G + to];
+    }
+    mg.sigt.push_back(st);
+    mg.sigs.push_back(ss);
+    mg.ne.push_back(ne);
+    mg.sigt0.push_back(MuRho(mat, E0));
+  }
+  return mg;
+}
+
+struct SNResult
+{
+  double uncollided; // transmitted uncollided current per incident photon
+  vector<double> transmitted; // [g] transmitted collided current per incident photon
+  vector<double> reflected; // [g] reflected current per incident photon
+  int sweeps;
+};
+
+SNResult SolveSN(const vector<Layer>& stack, const Multigroup& mg, double E0, int N, int maxCells)
+{
+  /*******
+  * Solve the slab problem for a unit current normally incident on the first layer; see the header of this file
+  *******/
+
+  int G = mg.G, L = mg.L;
+
+  // spatial mesh: cells of at most half a mean free path at the most absorbing group, within maxCells overall
+  vector<int> cellLayer;
+  vector<double> h;
+  double cellBudget = maxCells;
+  double totalTau = 0.0;
+  for (size_t i = 0; i < stack.size(); i++) totalTau += *max_element(mg.sigt[i].begin(), mg.sigt[i].end()) * stack[i].thickness;
+  for (size_t i = 0; i < stack.size(); i++)
+  {
+    double tau = *max_element(mg.sigt[i].begin(), mg.sigt[i].end()) * stack[i].thickness;
+    int n = max(4, (int)ceil(min(2 * tau, cellBudget * tau / totalTau)));
+    for (int c = 0; c < n; c++) {cellLayer.push_back(i); h.push_back(stack[i].thickness / n);}
+  }
+  int nc = h.size();
+
+  // angular quadrature and Legendre values at the ordinates
+  vector<double> mu, w;
+  GaussLegendre(N, mu, w);
+  vector<double> P((L+1) * N), PL((L+1) * N);
+  for (int l = 0; l <= L; l++) for (int m = 0; m < N; m++) {PL[l*N + m] = Legendre(l, mu[m]); P[l*N + m] = (2*l + 1) / 2.0 * PL[l*N + m];}
+
+  // first-collision source from the uncollided beam: the cell-averaged beam flux times, for each ordinate, the
+  // Klein-Nishina scattering from E0 into the group through the angles of that ordinate's quadrature cell,
+  // so the source is positive and exact in angle rather than a truncated Legendre series of a peaked kernel
+  vector<double> beam(nc), first(stack.size() * G * N, 0.0); // first[(layer*G + g)*N + m] (1/cm per unit mu)
+  double tauLeft = 0.0;
+  for (int c = 0; c < nc; c++)
+  {
+    double st = mg.sigt0[cellLayer[c]] * h[c];
+    beam[c] = exp(-tauLeft) * (st > 1e-12 ? (1 - exp(-st)) / st : 1.0);
+    tauLeft += st;
+  }
+  vector<double> xq, wq;
+  GaussLegendre(16, xq, wq);
+  for (int g = 0; g < G; g++)
+  {
+    double cHi = min(1.0, 1 - ELECTRON_MASS_KEV * (1/min(mg.Eb[g], E0) - 1/E0));
+    double cLo = max(-1.0, 1 - ELECTRON_MASS_KEV * (1/mg.Eb[g+1] - 1/E0));
+    double edge = -1.0;
+    for (int m = 0; m < N; m++)
+    {
+      double lo = max(cLo, edge), hi = min(cHi, edge + w[m]);
+      edge += w[m];
+      if (hi <= lo) continue;
+      double kn = 0.0;
+      for (size_t q = 0; q < xq.size(); q++) kn += 2 * M_PI * KleinNishina(E0, 0.5*(lo + hi) + 0.5*(hi - lo)*xq[q]) * 0.5*(hi - lo) * wq[q];
+      for (size_t i = 0; i < stack.size(); i++) first[(i*G + g)*N + m] = mg.ne[i] * kn / w[m];
+    }
+  }
+  vector<double> Q((size_t)G * (L+1) * nc, 0.0); // [g][l][cell] downscatter moments from higher collided groups
+
+  SNResult res;
+  res.uncollided = exp(-tauLeft);
+  res.transmitted.assign(G, 0.0);
+  res.reflected.assign(G, 0.0);
+  res.sweeps = 0;
+
+  vector<double> phi((L+1) * nc), phiNew((L+1) * nc), src(N), psi(N);
+  for (int g = 0; g < G; g++)
+  {
+    const double* Qg = &Q[(size_t)g*(L+1)*nc];
+    fill(phi.begin(), phi.end(), 0.0);
+    double leakR = 0.0, leakL = 0.0;
+    for (int iter = 0; iter < 500; iter++)
+    {
+      fill(phiNew.begin(), phiNew.end(), 0.0);
+      leakR = leakL = 0.0;
+
+      // sweep right (mu > 0) then left (mu < 0), vacuum on both faces
+      for (int dir = 0; dir < 2; dir++)
+      {
+        int m0 = dir == 0 ? N/2 : 0, m1 = dir == 0 ? N : N/2;
+        for (int m = m0; m < m1; m++) psi[m] = 0.0;
+        for (int k = 0; k < nc; k++)
+        {
+          int c = dir == 0 ? k : nc - 1 - k;
+          int i = cellLayer[c];
+          double st = mg.sigt[i][g];
+          for (int m = m0; m < m1; m++)
+          {
+            double s = 0.0;
+            for (int l = 0; l <= L; l++) s += P[l*N + m] * (Qg[l*nc + c] + mg.sigs[i][(l*G + g)*G + g] * phi[l*nc + c]);
+            src[m] = s + beam[c] * first[(i*G + g)*N + m];
+          }
+          for (int m = m0; m < m1; m++)
+          {
+            double a = 2 * fabs(mu[m]) / h[c];
+            double centre = (src[m] + a * psi[m]) / (a + st);
+            double outFlux = 2 * centre - psi[m];
+            if (outFlux < 0) {centre = (src[m] + 0.5 * a * psi[m]) / st; outFlux = 0.0;} // set-to-zero fixup, keeping cell balance
+            psi[m] = outFlux;
+            for (int l = 0; l <= L; l++) phiNew[l*nc + c] += w[m] * PL[l*N + m] * centre;
+          }
+        }
+        for (int m = m0; m < m1; m++) (dir == 0 ? leakR : leakL) += w[m] * fabs(mu[m]) * psi[m];
+      }
+      res.sweeps++;
+
+      // rebalance: scale so that leakage + removal equals the fixed source
+      double fixed = 0.0, removal = 0.0;
+      for (int c = 0; c < nc; c++)
+      {
+        int i = cellLayer[c];
+        fixed += Qg[c] * h[c];
+        for (int m = 0; m < N; m++) fixed += w[m] * beam[c] * first[(i*G + g)*N + m] * h[c];
+        removal += (mg.sigt[i][g] - mg.sigs[i][g*G + g]) * phiNew[c] * h[c];
+      }
+      double f = (leakR + leakL + removal) > 0 ? fixed / (leakR + leakL + removal) : 1.0;
+      double change = 0.0, norm = 0.0;
+      for (int j = 0; j < (L+1) * nc; j++)
+      {
+        phiNew[j] *= f;
+        if (j < nc) {change += fabs(phiNew[j] - phi[j]); norm += fabs(phiNew[j]);}
+      }
+      leakR *= f;
+      leakL *= f;
+      phi.swap(phiNew);
+      if (change <= 1e-7 * norm) break;
+    }
+    res.transmitted[g] = leakR;
+    res.reflected[g] = leakL;
+
+    // downscatter into the lower groups, in parallel over target groups
+    ParallelFor(G - g - 1, [&](int j)
+    {
+      int to = g + 1 + j;
+      for (int c = 0; c < nc; c++)
+        for (int l = 0; l <= L; l++) Q[((size_t)to*(L+1) + l)*nc + c] += mg.sigs[cellLayer[c]][(l*G + g)*G + to] * phi[l*nc + c];
+    });
+  }
+  return res;
+}
@@ -0,0 +1,177 @@
+/*******
+* Scatter.hh
+*   Compton (Klein-Nishina) scattering helpers and a deterministic single-scatter estimate for slab stacks.
+*
+* Dependencies:
+*   CalcAtten.hh: Material, Layer, LoadMaterial(), LogLogInterp(), MuRho() and ParallelFor()
+*   Tables.hh: StackLookup for the out-leg coefficients at the scattered energy
+*
+* Single-scatter geometry:
+*   the stack is a set of infinite slabs, first layer nearest the source, starting at z = 0
+*   an isotropic point source sits on the axis srcDist (cm) before the first layer, and a point detector
+*   detDist (cm) behind the last layer
+*   the scattered flux at the detector is integrated over every layer's volume, in cylindrical coordinates
+*   around the axis, with Gauss-Legendre quadrature in z and in u, where rho = c*tan(u)
+*   the in and out legs are attenuated with the loaded tables at E and at the scattered energy E'
+*   electrons are taken as free (no binding correction), and coherent scattering is not followed
+*
+* Ref:
+*   O. Klein and Y. Nishina, Z. Phys. 52 (1929) 853
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+const double ELECTRON_MASS_KEV = 510.99895; // m_e c^2 (keV)
+const double CLASSICAL_RADIUS2 = 7.9407877e-26; // r_e^2 (cm^2)
+const double AVOGADRO = 6.02214076e23; // 1/mol
+
+double ComptonEnergy(double E, double cosTheta)
+{
+  /*******
+  * Return the energy (keV) of a photon of energy E (keV) after Compton scattering through angle theta
+  *******/
+
+  return E / (1 + E / ELECTRON_MASS_KEV * (1 - cosTheta));
+}
+
+double KleinNishina(double E, double cosTheta)
+{
+  /*******
+  * Return the Klein-Nishina differential cross section dsigma/dOmega (cm^2/sr per electron)
+  *******/
+
+  double ratio = ComptonEnergy(E, cosTheta) / E; // E'/E
+  return 0.5 * CLASSICAL_RADIUS2 * ratio * ratio * (ratio + 1/ratio - (1 - cosTheta*cosTheta));
+}
+
+double KleinNishinaTotal(double E)
+{
+  /*******
+  * Return the total Klein-Nishina cross section (cm^2 per electron) at energy E (keV)
+  *******/
+
+  double k = E / ELECTRON_MASS_KEV;
+  double l = log(1 + 2*k);
+  return 2 * M_PI * CLASSICAL_RADIUS2 * ((1 + k) / (k*k) * (2*(1 + k) / (1 + 2*k) - l/k) + l / (2*k) - (1 + 3*k) / ((1 + 2*k)*(1 + 2*k)));
+}
+
+double ElectronDensity(const Material& mat)
+{
+  /*******
+  * Return the electron density (1/cm^3) of mat, which needs a Z/A(mol/g): line in its data file
+  *******/
+
+  if (mat.ZoverA <= 0) {cout << "Error: No Z/A(mol/g) for " << mat.name << ", needed for scattering" << endl; exit(EXIT_FAILURE);}
+  return mat.density * mat.ZoverA * AVOGADRO;
+}
+
+void GaussLegendre(int n, vector<double>& x, vector<double>& w)
+{
+  /*******
+  * Fill x, w with the n-point Gauss-Legendre nodes and weights on [-1, 1]
+  *******/
+
+  x.assign(n, 0.0);
+  w.assign(n, 0.0);
+  for (int i = 0; i < (n + 1) / 2; i++)
+  {
+    double z = cos(M_PI * (i + 0.75) / (n + 0.5)), dp = 0.0;
+    for (int iter = 0; iter < 100; iter++) // Newton iteration on P_n(z)
+    {
+      double p0 = 1.0, p1 = 0.0;
+      for (int j = 1; j <= n; j++) {double p2 = p1; p1 = p0; p0 = ((2*j - 1) * z * p1 - (j - 1) * p2) / j;}
+      dp = n * (z * p0 - p1) / (z*z - 1);
+      double dz = p0 / dp;
+      z -= dz;
+      if (fabs(dz) < 1e-15) break;
+    }
+    x[i] = -z;
+    x[n-1-i] = z;
+    w[i] = w[n-1-i] = 2 / ((1 - z*z) * dp * dp);
+  }
+}
+
+double SlabOpticalDepth(const vector<double>& zb, const double* mu, double za, double zb2, double length)
+{
+  /*******
+  * Return the optical depth of a straight path of the given length between depths za and zb2 through
+  * slabs with boundaries zb[0..n] and linear attenuation coefficients mu[0..n-1]; outside the slabs is void
+  *******/
+
+  double lo = min(za, zb2), hi = max(za, zb2), dz = hi - lo, tau = 0.0;
+  for (size_t i = 0; i + 1 < zb.size(); i++)
+  {
+    if (dz == 0.0) {if (lo >= zb[i] && lo < zb[i+1]) return mu[i] * length; continue;}
+    double overlap = min(hi, zb[i+1]) - max(lo, zb[i]);
+    if (overlap > 0) tau += mu[i] * overlap;
+  }
+  return dz == 0.0 ? 0.0 : tau * length / dz;
+}
+
+struct ScatterResult
+{
+  double uncollided; // flux per source photon at the detector (1/cm^2)
+  double scattered; // single-scatter flux per source photon (1/cm^2)
+  double uncollidedKerma; // air kerma per source photon (Gy)
+  double scatteredKerma;
+};
+
+ScatterResult SingleScatter(const vector<Layer>& stack, double E, double srcDist, double detDist, int nz, int nr)
+{
+  /*******
+  * Return the uncollided and single-scattered flux and air kerma at the detector; see the header of this file
+  *******/
+
+  int n = stack.size();
+  vector<double> zb(1, 0.0), mu0(n), ne(n);
+  StackLookup lookup(stack);
+  lookup.Eval(E, &mu0[0]);
+  for (int i = 0; i < n; i++)
+  {
+    zb.push_back(zb.back() + stack[i].thickness);
+    ne[i] = ElectronDensity(*lookup.mats[i]);
+  }
+  const Material& air = LoadMaterial("Air");
+  double zSrc = -srcDist, zDet = zb.back() + detDist;
+  double scale = zDet - zSrc; // rho = scale * tan(u)
+
+  vector<double> xz, wz, xr, wr;
+  GaussLegendre(nz, xz, wz);
+  GaussLegendre(nr, xr, wr);
+
+  // one parallel iteration per (layer, z node); each integrates over rho
+  vector<double> flux(n * nz, 0.0), kerma(n * nz, 0.0);
+  ParallelFor(n * nz, [&](int job)
+  {
+    int layer = job / nz, iz = job % nz;
+    double half = 0.5 * stack[layer].thickness;
+    double z = zb[layer] + half * (1 + xz[iz]), wzi = wz[iz] * half;
+    vector<double> mu1(n);
+    for (int ir = 0; ir < nr; ir++)
+    {
+      double u = 0.25 * M_PI * (1 + xr[ir]); // u in [0, pi/2)
+      double rho = scale * tan(u), drho = scale / (cos(u) * cos(u)) * 0.25 * M_PI * wr[ir];
+      double r1 = sqrt(rho*rho + (z - zSrc)*(z - zSrc)), r2 = sqrt(rho*rho + (zDet - z)*(zDet - z));
+      double cosTheta = (-rho*rho + (z - zSrc)*(zDet - z)) / (r1 * r2);
+      double E1 = ComptonEnergy(E, cosTheta);
+      lookup.Eval(E1, &mu1[0]);
+      double in = exp(-SlabOpticalDepth(zb, &mu0[0], zSrc, z, r1)) / (4 * M_PI * r1*r1);
+      double out = exp(-SlabOpticalDepth(zb, &mu1[0], z, zDet, r2)) / (r2*r2);
+      double f = in * ne[layer] * KleinNishina(E, cosTheta) * out * 2 * M_PI * rho * drho * wzi;
+      flux[job] += f;
+      kerma[job] += f * E1 * LogLogInterp(air.Es, air.MEACs, E1/1000.);
+    }
+  });
+
+  ScatterResult res;
+  double R = zDet - zSrc;
+  res.uncollided = exp(-SlabOpticalDepth(zb, &mu0[0], zSrc, zDet, R)) / (4 * M_PI * R*R);
+  res.uncollidedKerma = res.uncollided * E * LogLogInterp(air.Es, air.MEACs, E/1000.);
+  res.scattered = res.scatteredKerma = 0.0;
+  for (int j = 0; j < n * nz; j++) {res.scattered += flux[j]; res.scatteredKerma += kerma[j];}
+  double toGy = 1e-3 * 1.602176634e-13 * 1000.; // keV * MeV/keV * J/MeV * g/kg
+  res.uncollidedKerma *= toGy;
+  res.scatteredKerma *= toGy;
+  return res;
+}
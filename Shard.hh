@@ -0,0 +1,231 @@
+/*******
+* Shard.hh
+*   Local coordinator that shards work across worker processes over Unix sockets.
+*
+* Dependencies:
+*   CalcAtten.hh: SplitArgs() and numThreads
+*   Tables.hh: DetectNodes(), PinToNode() and nodeCpus
+*
+* Description:
+*   RunSharded() forks numWorkers workers, each connected to the coordinator by a socketpair. Workers inherit
+*   everything loaded so far (materials, tables, the stack) and are pinned round-robin to the NUMA nodes, so with
+*   one worker per node each process keeps to its own socket; within a worker, ParallelFor() still uses threads.
+*   The coordinator hands out shard numbers in order; a worker runs the shard's work function and sends back its
+*   result as bytes. Results are merged strictly in shard order as soon as the next one is in, so the output does
+*   not depend on which worker ran what, and is the same as running the shards in one process.
+*   Stragglers: once every shard has been handed out, an idle worker is given a copy of the oldest unfinished
+*   shard; whichever copy finishes first is used, and workers still busy at the end are killed. A worker that dies
+*   has its shard handed out again.
+*   Everything runs on one machine; a worker's socket could as well be a connection to another host.
+*   Testing: with CALCATTEN_SLOW_WORKER=w,s set, worker w sleeps s seconds before every shard, which exercises
+*   the straggler re-runs without a slow machine
+*
+* Protocol:
+*   coordinator to worker: shard number (long), -1 to stop
+*   worker to coordinator: result length (long), then the result bytes
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <poll.h> // waiting on all worker sockets at once
+#include <signal.h> // kill() for stragglers at the end
+#include <sys/socket.h> // socketpair() and send()
+#include <sys/wait.h> // waitpid()
+#include <unistd.h> // fork(), read(), close() and usleep()
+#include <cstdlib> // getenv() for CALCATTEN_SLOW_WORKER
+#include <cerrno> // errno, to retry calls interrupted by a signal
+
+const char* SLOW_WORKER_ENV = "CALCATTEN_SLOW_WORKER";
+
+int numWorkers = 0; // worker processes, 0 to run everything in this process
+
+void PutDoubles(string& out, const double* v, size_t n)
+{
+  out.append((const char*)v, n * sizeof(double));
+}
+
+void GetDoubles(const char*& in, double* v, size_t n)
+{
+  memcpy(v, in, n * sizeof(double));
+  in += n * sizeof(double);
+}
+
+bool SendAll(int fd, const void* data, size_t n)
+{
+  const char* p = (const char*)data;
+  while (n > 0)
+  {
+    ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+    if (k < 0 && errno == EINTR) continue;
+    if (k <= 0) return false;
+    p += k;
+    n -= k;
+  }
+  return true;
+}
+
+bool WriteAll(int fd, const void* data, size_t n)
+{
+  const char* p = (const char*)data;
+  while (n > 0)
+  {
+    ssize_t k = write(fd, p, n);
+    if (k < 0 && errno == EINTR) continue;
+    if (k <= 0) return false;
+    p += k;
+    n -= k;
+  }
+  return true;
+}
+
+bool ReadAll(int fd, void* data, size_t n)
+{
+  char* p = (char*)data;
+  while (n > 0)
+  {
+    ssize_t k = read(fd, p, n);
+    if (k < 0 && errno == EINTR) continue;
+    if (k <= 0) return false;
+    p += k;
+    n -= k;
+  }
+  return true;
+}
+
+long ShardSize(long nUnits)
+{
+  /*******
+  * Units of work per shard: about eight shards per worker, enough to balance the load and bound a straggler
+  *******/
+
+  return max(1L, nUnits / (8L * max(1, numWorkers)));
+}
+
+struct ShardWorker
+{
+  pid_t pid;
+  int fd;
+  long shard; // in flight, or -1 when idle
+  bool alive;
+  string buf; // partial result
+};
+
+void RunSharded(long nShards, function<string(long)> work, function<void(long, const string&)> merge)
+{
+  /*******
+  * Run work(s) for s = 0 .. nShards-1 on the worker processes and call merge(s, result) in shard order
+  *******/
+
+  int nW = min((long)numWorkers, nShards);
+  int slowWorker = -1;
+  double slowWorkerDelay = 0.0;
+  const char* slow = getenv(SLOW_WORKER_ENV);
+  if (slow)
+  {
+    vector<string> args = SplitArgs(slow);
+    if (args.size() != 2) {cout << "Error: " << SLOW_WORKER_ENV << " expects worker,s" << endl; exit(EXIT_FAILURE);}
+    slowWorker = stoi(args[0]);
+    slowWorkerDelay = stod(args[1]);
+  }
+  DetectNodes();
+  cout.flush();
+  vector<ShardWorker> workers(nW);
+  for (int w = 0; w < nW; w++)
+  {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {cout << "Error: Could not create worker socket" << endl; exit(EXIT_FAILURE);}
+    pid_t pid = fork();
+    if (pid < 0) {cout << "Error: Could not start worker" << endl; exit(EXIT_FAILURE);}
+    if (pid == 0)
+    {
+      // worker: serve shards until told to stop or the coordinator goes away
+      close(fds[0]);
+      for (int v = 0; v < w; v++) close(workers[v].fd);
+      if (nodeCpus.size() > 1) PinToNode(w % nodeCpus.size());
+      long shard;
+      while (ReadAll(fds[1], &shard, sizeof(shard)) && shard >= 0)
+      {
+        if (w == slowWorker) usleep((useconds_t)(slowWorkerDelay * 1e6));
+        string result = work(shard);
+        long len = result.size();
+        if (!SendAll(fds[1], &len, sizeof(len)) || !SendAll(fds[1], result.data(), len)) break;
+      }
+      _exit(0);
+    }
+    close(fds[1]);
+    workers[w] = ShardWorker{pid, fds[0], -1, true, ""};
+  }
+
+  vector<string> results(nShards);
+  vector<char> done(nShards, 0);
+  vector<int> copies(nShards, 0); // workers running each shard
+  vector<long> requeued; // shards of dead workers
+  long next = 0, merged = 0, reruns = 0;
+  while (merged < nShards)
+  {
+    // hand out work to idle workers: new shards first, then copies of the oldest unfinished one
+    for (int w = 0; w < nW; w++)
+    {
+      if (!workers[w].alive || workers[w].shard >= 0) continue;
+      long s = -1;
+      while (!requeued.empty() && s < 0) {if (!done[requeued.back()]) s = requeued.back(); requeued.pop_back();}
+      if (s < 0 && next < nShards) s = next++;
+      if (s < 0)
+        for (long t = merged; t < next; t++) if (!done[t] && copies[t] < 2) {s = t; reruns++; break;}
+      if (s < 0) continue;
+      if (!SendAll(workers[w].fd, &s, sizeof(s))) {workers[w].alive = false; requeued.push_back(s); continue;}
+      workers[w].shard = s;
+      copies[s]++;
+    }
+
+    // wait for results
+    vector<pollfd> fds;
+    vector<int> who;
+    for (int w = 0; w < nW; w++) if (workers[w].alive && workers[w].shard >= 0) {fds.push_back(pollfd{workers[w].fd, POLLIN, 0}); who.push_back(w);}
+    if (fds.empty()) {cout << "Error: All workers have died" << endl; exit(EXIT_FAILURE);}
+    if (poll(fds.data(), fds.size(), -1) < 0)
+    {
+      if (errno == EINTR) continue;
+      cout << "Error: Could not wait for the workers" << endl; exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < fds.size(); i++)
+    {
+      if (!fds[i].revents) continue;
+      ShardWorker& sw = workers[who[i]];
+      char chunk[1 << 16];
+      ssize_t k = read(sw.fd, chunk, sizeof(chunk));
+      if (k < 0 && errno == EINTR) continue;
+      if (k <= 0) // the worker died: hand its shard out again
+      {
+        sw.alive = false;
+        copies[sw.shard]--;
+        if (!done[sw.shard]) requeued.push_back(sw.shard);
+        continue;
+      }
+      sw.buf.append(chunk, k);
+      long len;
+      if (sw.buf.size() < sizeof(len)) continue;
+      memcpy(&len, sw.buf.data(), sizeof(len));
+      if (sw.buf.size() < sizeof(len) + len) continue;
+      if (!done[sw.shard]) {results[sw.shard] = sw.buf.substr(sizeof(len), len); done[sw.shard] = 1;}
+      copies[sw.shard]--;
+      sw.buf.clear();
+      sw.shard = -1;
+    }
+
+    // merge the finished prefix
+    while (merged < nShards && done[merged]) {merge(merged, results[merged]); string().swap(results[merged]); merged++;}
+  }
+
+  // stop idle workers, kill the ones still running a copy
+  for (int w = 0; w < nW; w++)
+  {
+    long stop = -1;
+    if (workers[w].alive && workers[w].shard < 0) SendAll(workers[w].fd, &stop, sizeof(stop));
+    else kill(workers[w].pid, SIGKILL);
+    close(workers[w].fd);
+    waitpid(workers[w].pid, NULL, 0);
+  }
+  if (reruns > 0) cout << "  " << reruns << " straggling shards re-run on idle workers" << endl;
+}
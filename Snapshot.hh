@@ -0,0 +1,268 @@
+/*******
+* Snapshot.hh
+*   Warm-state snapshots: everything a run has loaded and built, saved to one file and mapped back in at startup.
+*
+* Dependencies:
+*   CalcAtten.hh: Material, materialCache, DataFileTable, dataFileCache, DataFilePath(), Density() and
+*   ReadDataFileMACs()
+*   Tables.hh: UnionGrid, unionNames, unionReplicas, FreeTables(), AllocHuge(), DetectNodes(), PinToNode(),
+*   unionReplicate and HUGE_PAGE_BYTES
+*   Shard.hh: GetDoubles()
+*
+* Contents:
+*   the loaded materials (data files, MaterialDB entries); the data-file tables the Shield command reads, for
+*   every loaded material, read now for those the run has not read ahead of time (only a zygote does); and, if
+*   PackTables has been run, the union-grid tables with their material order and NUMA replication setting
+*   the engine keeps no other derived state: stacks are rebuilt from the macro as it runs, and a hypercube is
+*   already a file that HypercubeOpen maps
+*
+* Layout:
+*   SnapshotHeader, then per material: char name[32], double density, double Z/A, int32 n, int32 nEA, Es[n],
+*   MACs[n], MEACs[nEA]; per data file: char name[32], double density, int32 n, Es[n], MACs[n]; the table
+*   material names, char[32] each; then, at tableOffset (a multiple of HUGE_PAGE_BYTES), ln(E) and ln(mu) as
+*   in UnionGrid, i.e. exactly the block PackTables() builds
+*   a snapshot is for this build on this machine: the header records the size of SnapshotHeader it was written
+*   with, and every section is checked against the counts and offsets in the header before it is read
+*
+* Restore:
+*   the file is mapped read-only; materials and data files are copied into the caches (small), and the tables
+*   are used in place from the mapping, so nothing is re-parsed or recomputed and pages come in from the page
+*   cache as they are read; with NUMA replication on and more than one node, each node gets its own copy,
+*   copied (not rebuilt) from the mapping by a thread pinned to it, as PackTables() does
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <fcntl.h> // open() for mapping a snapshot
+#include <sys/stat.h> // fstat() for its size
+
+struct SnapshotHeader
+{
+  char magic[8]; // "CASNAP02"
+  int headerBytes; // sizeof(SnapshotHeader), against a mismatched build
+  int nMaterials;
+  int nDataFiles;
+  int nTableMats; // 0 if no tables were packed
+  int nE;
+  int replicate;
+  size_t tableOffset;
+  size_t tableBytes;
+};
+
+void SnapshotName(ofstream& out, string s)
+{
+  char name[32] = {0};
+  strncpy(name, s.c_str(), 31);
+  out.write(name, 32);
+}
+
+string SnapshotReadName(const char*& p)
+{
+  string s(p, strnlen(p, 32));
+  p += 32;
+  return s;
+}
+
+int SnapshotReadInt(const char*& p)
+{
+  int v;
+  memcpy(&v, p, sizeof(v));
+  p += sizeof(v);
+  return v;
+}
+
+void SnapshotTruncated()
+{
+  cout << "Error: Truncated snapshot" << endl;
+  exit(EXIT_FAILURE);
+}
+
+void SaveSnapshot(string fileName)
+{
+  /*******
+  * Write the loaded materials, parsed data files and packed tables to fileName
+  *******/
+
+  // the data-file tables of every loaded material, as the zygote reads them ahead of time
+  map<string, DataFileTable> dataFiles;
+  for (map<string, Material>::iterator it = materialCache.begin(); it != materialCache.end(); it++)
+  {
+    map<string, DataFileTable>::iterator c = dataFileCache.find(it->first);
+    if (c != dataFileCache.end()) {dataFiles.insert(*c); continue;}
+    if (!ifstream(DataFilePath(it->first)).is_open()) continue;
+    DataFileTable& t = dataFiles[it->first];
+    t.density = Density(it->first);
+    ReadDataFileMACs(it->first, t.Es, t.MACs);
+  }
+
+  SnapshotHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "CASNAP02", 8);
+  h.headerBytes = sizeof(SnapshotHeader);
+  h.nMaterials = materialCache.size();
+  h.nDataFiles = dataFiles.size();
+  const UnionGrid* g = unionReplicas.empty() ? NULL : &unionReplicas[0];
+  h.nTableMats = g ? g->nMat : 0;
+  h.nE = g ? g->nE : 0;
+  h.replicate = unionReplicate;
+  h.tableBytes = g ? g->bytes : 0;
+
+  ofstream out(fileName, ios::binary);
+  if (!out.is_open()) {cout << "Error: Snapshot file not open for writing" << endl; exit(EXIT_FAILURE);}
+  out.write((const char*)&h, sizeof(h));
+  for (map<string, Material>::iterator it = materialCache.begin(); it != materialCache.end(); it++)
+  {
+    const Material& m = it->second;
+    int n = m.Es.size(), nEA = m.MEACs.size();
+    SnapshotName(out, it->first);
+    out.write((const char*)&m.density, sizeof(double));
+    out.write((const char*)&m.ZoverA, sizeof(double));
+    out.write((const char*)&n, sizeof(n));
+    out.write((const char*)&nEA, sizeof(nEA));
+    out.write((const char*)m.Es.data(), n * sizeof(double));
+    out.write((const char*)m.MACs.data(), n * sizeof(double));
+    out.write((const char*)m.MEACs.data(), nEA * sizeof(double));
+  }
+  for (map<string, DataFileTable>::iterator it = dataFiles.begin(); it != dataFiles.end(); it++)
+  {
+    const DataFileTable& t = it->second;
+    int n = t.Es.size();
+    SnapshotName(out, it->first);
+    out.write((const char*)&t.density, sizeof(double));
+    out.write((const char*)&n, sizeof(n));
+    out.write((const char*)t.Es.data(), n * sizeof(double));
+    out.write((const char*)t.MACs.data(), n * sizeof(double));
+  }
+  for (int m = 0; m < h.nTableMats; m++) SnapshotName(out, unionNames[m]);
+
+  // the tables start on a huge page boundary, after a hole
+  size_t at = out.tellp();
+  h.tableOffset = g ? (at + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES : at;
+  if (g) {out.seekp(h.tableOffset); out.write((const char*)g->lnE, g->bytes);}
+  out.seekp(0);
+  out.write((const char*)&h, sizeof(h));
+  if (!out) {cout << "Error: Could not write snapshot" << endl; exit(EXIT_FAILURE);}
+  cout << "  Saved " << h.nMaterials << " materials, " << h.nDataFiles << " data files and "
+       << (g ? to_string(h.nTableMats) + " packed materials" : "no packed tables") << " to " << fileName << endl;
+}
+
+void RestoreSnapshot(string fileName)
+{
+  /*******
+  * Replace the loaded materials, parsed data files and packed tables with those of a snapshot
+  *******/
+
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {cout << "Error: Snapshot file not open" << endl; exit(EXIT_FAILURE);}
+  struct stat st;
+  fstat(fd, &st);
+  size_t size = st.st_size;
+  void* map = (size >= sizeof(SnapshotHeader)) ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED) {cout << "Error: Could not map snapshot" << endl; exit(EXIT_FAILURE);}
+  SnapshotHeader h;
+  memcpy(&h, map, sizeof(h));
+  if (memcmp(h.magic, "CASNAP02", 8) != 0 || h.headerBytes != (int)sizeof(SnapshotHeader))
+    {cout << "Error: Not a snapshot of this build" << endl; exit(EXIT_FAILURE);}
+
+  // the sections must be where the header says: records between the header and tableOffset, and the tables,
+  // if any, of exactly nE * (nTableMats + 1) doubles on a huge page boundary, ending within the file
+  if (h.nMaterials < 0 || h.nDataFiles < 0 || h.nTableMats < 0 || h.tableOffset < sizeof(h) || h.tableOffset > size)
+    SnapshotTruncated();
+  if (h.nTableMats > 0 && (h.nE < 2 || h.tableOffset % HUGE_PAGE_BYTES != 0
+      || h.tableBytes != (size_t)h.nE * (h.nTableMats + 1) * sizeof(double) || h.tableBytes > size - h.tableOffset))
+    SnapshotTruncated();
+  if (h.nTableMats == 0 && h.tableBytes != 0) SnapshotTruncated();
+  const size_t materialBytes = 32 + 2 * sizeof(double) + 2 * sizeof(int); // before Es, MACs and MEACs
+  const size_t dataFileBytes = 32 + sizeof(double) + sizeof(int); // before Es and MACs
+
+  // materials and data files: small, copied into the caches
+  const char* p = (const char*)map + sizeof(h);
+  const char* end = (const char*)map + h.tableOffset;
+  materialCache.clear();
+  dataFileCache.clear();
+  for (int i = 0; i < h.nMaterials; i++)
+  {
+    if ((size_t)(end - p) < materialBytes) SnapshotTruncated();
+    Material m;
+    m.name = SnapshotReadName(p);
+    GetDoubles(p, &m.density, 1);
+    GetDoubles(p, &m.ZoverA, 1);
+    int n = SnapshotReadInt(p), nEA = SnapshotReadInt(p);
+    if (n < 0 || nEA < 0 || (2 * (size_t)n + nEA) * sizeof(double) > (size_t)(end - p)) SnapshotTruncated();
+    m.Es.resize(n);
+    m.MACs.resize(n);
+    m.MEACs.resize(nEA);
+    GetDoubles(p, m.Es.data(), n);
+    GetDoubles(p, m.MACs.data(), n);
+    GetDoubles(p, m.MEACs.data(), nEA);
+    materialCache[m.name] = m;
+  }
+  for (int i = 0; i < h.nDataFiles; i++)
+  {
+    if ((size_t)(end - p) < dataFileBytes) SnapshotTruncated();
+    string name = SnapshotReadName(p);
+    DataFileTable t;
+    GetDoubles(p, &t.density, 1);
+    int n = SnapshotReadInt(p);
+    if (n < 0 || 2 * (size_t)n * sizeof(double) > (size_t)(end - p)) SnapshotTruncated();
+    t.Es.resize(n);
+    t.MACs.resize(n);
+    GetDoubles(p, t.Es.data(), n);
+    GetDoubles(p, t.MACs.data(), n);
+    dataFileCache[name] = t;
+  }
+
+  // tables: used in place, or copied once per node
+  FreeTables();
+  if (h.nTableMats == 0) munmap(map, size);
+  else
+  {
+    if (32 * (size_t)h.nTableMats > (size_t)(end - p)) SnapshotTruncated();
+    for (int m = 0; m < h.nTableMats; m++) unionNames.push_back(SnapshotReadName(p));
+    const double* block = (const double*)((const char*)map + h.tableOffset);
+    DetectNodes();
+    int nNodes = h.replicate ? nodeCpus.size() : 1;
+    unionReplicas.resize(nNodes);
+    for (int node = 0; node < nNodes; node++)
+    {
+      UnionGrid& g = unionReplicas[node];
+      g.nE = h.nE;
+      g.nMat = h.nTableMats;
+      g.bytes = h.tableBytes;
+    }
+    if (nNodes == 1)
+    {
+      UnionGrid& g = unionReplicas[0];
+      g.mem = map;
+      g.mapped = size;
+      g.lnE = (double*)block;
+      g.lnMu = g.lnE + g.nE;
+    }
+    else
+    {
+      vector<thread> copiers;
+      for (int node = 0; node < nNodes; node++)
+      {
+        copiers.push_back(thread([&, node]()
+        {
+          PinToNode(node);
+          UnionGrid& g = unionReplicas[node];
+          bool explicitHuge;
+          g.mem = AllocHuge(g.bytes, explicitHuge);
+          g.mapped = (g.bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+          g.lnE = (double*)g.mem;
+          g.lnMu = g.lnE + g.nE;
+          memcpy(g.mem, block, g.bytes);
+        }));
+      }
+      for (size_t c = 0; c < copiers.size(); c++) copiers[c].join();
+      munmap(map, size);
+      workerInit = [](int w) {int node = w % unionReplicas.size(); PinToNode(node); localTables = &unionReplicas[node];};
+    }
+    unionReplicate = h.replicate;
+  }
+  cout << "  Restored " << h.nMaterials << " materials, " << h.nDataFiles << " data files and "
+       << (h.nTableMats ? to_string(h.nTableMats) + " packed materials" : "no packed tables") << " from " << fileName << endl;
+}
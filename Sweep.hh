@@ -0,0 +1,354 @@
+/*******
+* Sweep.hh
+*   Transmission of the stack over a dense energy sweep, streamed to disk in full and/or as a plot-ready curve.
+*
+* Dependencies:
+*   CalcAtten.hh: Layer, LoadMaterial() and ParallelFor()
+*   Tables.hh: StackLookup
+*   Shard.hh: RunSharded(), PutDoubles(), GetDoubles() and numWorkers
+*
+* Sweep:
+*   n log-spaced energies from E1 to E2, plus every absorption edge of the stack's materials in range, each edge
+*   once just below and once at the edge, so the jump is exact rather than smeared between two grid points
+*   the sweep runs in chunks of SWEEP_CHUNK energies; a round of chunks is evaluated and formatted in parallel,
+*   then written and fed to the downsampler in order, so memory stays bounded for any n
+*   with Workers on, each chunk is a shard: workers send back its points and text, which are written and
+*   downsampled in chunk order as they arrive, so the output is the same as in one process
+*
+* Downsampling (the plot file):
+*   the regular points are split into a fixed number of buckets of consecutive energies, i.e. equal widths on a
+*   log energy axis, one per plot pixel column
+*   minmax keeps the first, last, smallest and largest point of each bucket, which draws the same pixels as the
+*   full curve; lttb (largest triangle three buckets) keeps the one point per bucket that makes the largest
+*   triangle with the previous kept point and the next bucket's average, with areas in ln(E), ln(T) as the
+*   curve is normally plotted log-log
+*   edge points are always kept, whatever the mode, as are the first and last points
+*   both are streaming: minmax holds one bucket, lttb two
+*
+* Adaptive sweep:
+*   starts from SWEEP_ADAPTIVE_PER_DECADE log-spaced energies per decade, the edge pairs and every other energy
+*   of the materials' tables, where interpolated coefficients have kinks that a midpoint test can miss, so that
+*   the curve is smooth within every interval; it then bisects (in
+*   ln E) every interval whose midpoint ln T differs from the straight line between its ends by more than the
+*   tolerance, i.e. where linear interpolation on a log-log plot is off by more than that relative error
+*   the two points of an edge pair are never refined between, since the jump is real; intervals stop at a
+*   relative width of SWEEP_ADAPTIVE_MIN_WIDTH
+*   the points come out in energy order, as "E T" like the full Sweep output
+*
+* Ref:
+*   S. Steinarsson, "Downsampling time series for visual representation", MSc thesis, University of Iceland (2013)
+*   U. Jugel et al., "M4: a visualization-oriented time series data aggregation", Proc. VLDB Endow. 7 (2014) 797
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <cstdio> // snprintf() for fast formatting of the full output
+
+const long SWEEP_CHUNK = 1 << 16;
+const int SWEEP_ADAPTIVE_PER_DECADE = 8;
+const double SWEEP_ADAPTIVE_MIN_WIDTH = 1e-7;
+
+struct SweepPoint
+{
+  double E, T; // keV, transmission
+  bool edge; // below or at an absorption edge; always kept
+};
+
+struct Downsampler
+{
+  /*******
+  * Streaming minmax or lttb reduction of nRegular points (plus edge points) to about buckets points
+  *******/
+
+  ostream& out;
+  string mode;
+  long nRegular, buckets, seen; // seen: regular points so far
+  vector<SweepPoint> cur, next; // points of the current (and, for lttb, the next) bucket
+  long curBucket;
+  bool haveLast;
+  SweepPoint last; // last point written
+
+  Downsampler(ostream& o, string m, long n, long b) : out(o), mode(m), nRegular(n), buckets(b), seen(0), curBucket(0), haveLast(false) {}
+
+  void Write(const SweepPoint& p)
+  {
+    if (haveLast && p.E <= last.E) return; // a point chosen twice
+    out << p.E << " " << p.T << "\n";
+    last = p;
+    haveLast = true;
+  }
+
+  long Bucket(long i) const
+  {
+    // first and last regular points get buckets of their own
+    if (i == 0) return 0;
+    if (i >= nRegular - 1) return buckets - 1;
+    return 1 + (i - 1) * (buckets - 2) / max(1L, nRegular - 2);
+  }
+
+  void WriteSorted(vector<SweepPoint>& pts)
+  {
+    sort(pts.begin(), pts.end(), [](const SweepPoint& a, const SweepPoint& b) {return a.E < b.E;});
+    for (size_t i = 0; i < pts.size(); i++) Write(pts[i]);
+  }
+
+  void FlushMinMax()
+  {
+    vector<SweepPoint> keep;
+    int lo = -1, hi = -1, first = -1, lastReg = -1;
+    for (size_t i = 0; i < cur.size(); i++)
+    {
+      if (cur[i].edge) {keep.push_back(cur[i]); continue;}
+      if (first < 0) first = i;
+      lastReg = i;
+      if (lo < 0 || cur[i].T < cur[lo].T) lo = i;
+      if (hi < 0 || cur[i].T > cur[hi].T) hi = i;
+    }
+    if (first >= 0) {keep.push_back(cur[first]); keep.push_back(cur[lo]); keep.push_back(cur[hi]); keep.push_back(cur[lastReg]);}
+    WriteSorted(keep);
+    cur.clear();
+  }
+
+  void FlushTriangle(double nextX, double nextY)
+  {
+    // keep the point of cur making the largest triangle with the last written point and (nextX, nextY)
+    vector<SweepPoint> keep;
+    int best = -1;
+    double bestArea = -1.0;
+    double ax = log(last.E), ay = log(max(last.T, 1e-300));
+    for (size_t i = 0; i < cur.size(); i++)
+    {
+      if (cur[i].edge) {keep.push_back(cur[i]); continue;}
+      double x = log(cur[i].E), y = log(max(cur[i].T, 1e-300));
+      double area = fabs((ax - nextX) * (y - ay) - (ax - x) * (nextY - ay));
+      if (area > bestArea) {bestArea = area; best = i;}
+    }
+    if (best >= 0) keep.push_back(cur[best]);
+    WriteSorted(keep);
+    cur.clear();
+  }
+
+  void Average(const vector<SweepPoint>& pts, double& x, double& y)
+  {
+    long n = 0;
+    x = y = 0.0;
+    for (size_t i = 0; i < pts.size(); i++) if (!pts[i].edge) {x += log(pts[i].E); y += log(max(pts[i].T, 1e-300)); n++;}
+    if (n > 0) {x /= n; y /= n;}
+  }
+
+  void Add(const SweepPoint& p)
+  {
+    if (nRegular <= buckets) {Write(p); return;} // nothing to reduce
+    if (mode == "minmax")
+    {
+      long b = p.edge ? curBucket : Bucket(seen++);
+      if (b > curBucket) {FlushMinMax(); curBucket = b;}
+      cur.push_back(p);
+      return;
+    }
+
+    // lttb: cur holds bucket curBucket and next the one after; cur is chosen from once next is complete
+    // edge points join the bucket of the regular point before them
+    if (p.edge) {if (curBucket == 0) Write(p); else (next.empty() ? cur : next).push_back(p); return;}
+    long b = Bucket(seen++);
+    if (b == 0) {Write(p); return;}
+    if (curBucket == 0) curBucket = b;
+    if (b == curBucket + 2)
+    {
+      double x, y;
+      Average(next, x, y);
+      FlushTriangle(x, y);
+      cur.swap(next);
+      curBucket++;
+    }
+    (b == curBucket ? cur : next).push_back(p);
+  }
+
+  void Finish()
+  {
+    if (nRegular <= buckets) return;
+    if (mode == "minmax") {FlushMinMax(); return;}
+    if (!next.empty()) // next is the last bucket, holding only the last point
+    {
+      double x, y;
+      Average(next, x, y);
+      FlushTriangle(x, y);
+      cur.swap(next);
+    }
+    WriteSorted(cur);
+  }
+};
+
+vector<double> SweepEdges(const StackLookup& lookup, double E1, double E2)
+{
+  /*******
+  * Return the absorption edges (keV) of the stack's materials strictly between E1 and E2, sorted
+  *******/
+
+  vector<double> edges;
+  for (size_t i = 0; i < lookup.mats.size(); i++)
+  {
+    const vector<double>& Es = lookup.mats[i]->Es;
+    for (size_t j = 1; j < Es.size(); j++)
+    {
+      double edge = Es[j] * 1000.; // MeV to keV
+      if (Es[j] == Es[j-1] && edge > E1 && edge < E2) edges.push_back(edge);
+    }
+  }
+  sort(edges.begin(), edges.end());
+  edges.erase(unique(edges.begin(), edges.end()), edges.end());
+  return edges;
+}
+
+double SweepPointT(const StackLookup& lookup, const vector<Layer>& stack, double E, vector<double>& mu)
+{
+  lookup.Eval(E, mu.data());
+  double tau = 0.0;
+  for (size_t l = 0; l < stack.size(); l++) tau += mu[l] * stack[l].thickness;
+  return exp(-tau);
+}
+
+void SweepTransmission(const vector<Layer>& stack, double E1, double E2, long n, string fullFile, string plotFile, string plotMode, long buckets)
+{
+  /*******
+  * Sweep the transmission of stack over [E1, E2] keV; write every point to fullFile and/or the downsampled curve
+  * to plotFile (either may be empty)
+  *******/
+
+  StackLookup lookup(stack);
+  vector<double> edges = SweepEdges(lookup, E1, E2);
+
+  ofstream full, plot;
+  if (!fullFile.empty()) {full.open(fullFile); if (!full.is_open()) {cout << "Error: Sweep output not open" << endl; exit(EXIT_FAILURE);}}
+  if (!plotFile.empty()) {plot.open(plotFile); if (!plot.is_open()) {cout << "Error: Sweep plot file not open" << endl; exit(EXIT_FAILURE);}}
+  plot.precision(10);
+  Downsampler down(plot, plotMode, n, buckets);
+
+  double step = (n > 1) ? log(E2 / E1) / (n - 1) : 0.0;
+  long nChunks = (n + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+  long perRound = 4 * max(1, numThreads > 0 ? numThreads : (int)thread::hardware_concurrency());
+  auto runChunk = [&](long c, vector<SweepPoint>& pts, string& s)
+  {
+    long i0 = c * SWEEP_CHUNK, i1 = min(n, i0 + SWEEP_CHUNK);
+    pts.clear();
+
+    // regular points of the chunk, with the edges falling between its first point and the next chunk's
+    double lo = E1 * exp(step * i0), hi = (i1 < n) ? E1 * exp(step * i1) : E2 * 2;
+    vector<double>::const_iterator e = lower_bound(edges.begin(), edges.end(), lo);
+    for (long i = i0; i < i1; i++)
+    {
+      double Ei = (i == n - 1) ? E2 : E1 * exp(step * i), Enext = (i + 1 < i1) ? E1 * exp(step * (i + 1)) : hi;
+      pts.push_back(SweepPoint{Ei, 0.0, false});
+      for (; e != edges.end() && *e < Enext; e++)
+      {
+        if (*e * (1 - 1e-9) > Ei) pts.push_back(SweepPoint{*e * (1 - 1e-9), 0.0, true});
+        pts.push_back(SweepPoint{*e, 0.0, true});
+      }
+    }
+
+    vector<double> mu(stack.size());
+    for (size_t j = 0; j < pts.size(); j++) pts[j].T = SweepPointT(lookup, stack, pts[j].E, mu);
+
+    s.clear();
+    if (fullFile.empty()) return;
+    char buf[64];
+    for (size_t j = 0; j < pts.size(); j++) s.append(buf, snprintf(buf, sizeof(buf), "%.10g %.10g\n", pts[j].E, pts[j].T));
+  };
+  auto emit = [&](const vector<SweepPoint>& pts, const string& s)
+  {
+    if (!fullFile.empty()) full.write(s.data(), s.size());
+    if (!plotFile.empty()) for (size_t j = 0; j < pts.size(); j++) down.Add(pts[j]);
+  };
+
+  if (numWorkers > 0)
+  {
+    // a shard is one chunk: its point count, the points as (E, T, edge) triples, then its text
+    RunSharded(nChunks, [&](long c)
+    {
+      vector<SweepPoint> pts;
+      string s, out;
+      runChunk(c, pts, s);
+      double count = pts.size();
+      PutDoubles(out, &count, 1);
+      for (size_t j = 0; j < pts.size(); j++) {double v[3] = {pts[j].E, pts[j].T, (double)pts[j].edge}; PutDoubles(out, v, 3);}
+      return out + s;
+    },
+    [&](long, const string& result)
+    {
+      const char* in = result.data();
+      double count;
+      GetDoubles(in, &count, 1);
+      vector<SweepPoint> pts((size_t)count);
+      for (size_t j = 0; j < pts.size(); j++) {double v[3]; GetDoubles(in, v, 3); pts[j] = SweepPoint{v[0], v[1], v[2] != 0};}
+      emit(pts, string(in, result.data() + result.size() - in));
+    });
+  }
+  else
+  {
+    vector<vector<SweepPoint> > points(perRound);
+    vector<string> text(perRound);
+    for (long c0 = 0; c0 < nChunks; c0 += perRound)
+    {
+      long nRound = min(perRound, nChunks - c0);
+      ParallelFor(nRound, [&](int k) {runChunk(c0 + k, points[k], text[k]);});
+      for (long k = 0; k < nRound; k++) emit(points[k], text[k]);
+    }
+  }
+  if (!plotFile.empty()) down.Finish();
+}
+
+long AdaptiveSweep(const vector<Layer>& stack, double E1, double E2, double tol, string fileName)
+{
+  /*******
+  * Write the transmission of stack over [E1, E2] keV, refined to tol in ln T; return the points evaluated
+  *******/
+
+  StackLookup lookup(stack);
+  vector<double> edges = SweepEdges(lookup, E1, E2), mu(stack.size());
+  ofstream out(fileName);
+  if (!out.is_open()) {cout << "Error: Sweep output not open" << endl; exit(EXIT_FAILURE);}
+
+  // coarse grid: log-spaced points, the table energies and the edge pairs
+  int n = max(2, (int)ceil(SWEEP_ADAPTIVE_PER_DECADE * log10(E2 / E1)) + 1);
+  vector<SweepPoint> coarse;
+  for (int i = 0; i < n; i++) coarse.push_back(SweepPoint{(i == n - 1) ? E2 : E1 * pow(E2 / E1, (double)i / (n - 1)), 0.0, false});
+  for (size_t i = 0; i < lookup.mats.size(); i++)
+    for (size_t j = 0; j < lookup.mats[i]->Es.size(); j++)
+    {
+      double E = lookup.mats[i]->Es[j] * 1000.;
+      if (E > E1 && E < E2 && !binary_search(edges.begin(), edges.end(), E)) coarse.push_back(SweepPoint{E, 0.0, false});
+    }
+  for (size_t e = 0; e < edges.size(); e++)
+  {
+    coarse.push_back(SweepPoint{edges[e] * (1 - 1e-9), 0.0, true});
+    coarse.push_back(SweepPoint{edges[e], 0.0, false});
+  }
+  sort(coarse.begin(), coarse.end(), [](const SweepPoint& a, const SweepPoint& b) {return a.E < b.E;});
+  coarse.erase(unique(coarse.begin(), coarse.end(), [](const SweepPoint& a, const SweepPoint& b) {return a.E == b.E;}), coarse.end());
+  for (size_t i = 0; i < coarse.size(); i++) coarse[i].T = SweepPointT(lookup, stack, coarse[i].E, mu);
+  long evaluations = coarse.size();
+
+  // refine each interval depth-first, so points are written in order; edge marks the point just below an edge
+  char buf[64];
+  vector<SweepPoint> todo; // right ends of the intervals still to refine, nearest last
+  SweepPoint left = coarse[0];
+  out.write(buf, snprintf(buf, sizeof(buf), "%.10g %.10g\n", left.E, left.T));
+  for (size_t i = coarse.size() - 1; i > 0; i--) todo.push_back(coarse[i]);
+  while (!todo.empty())
+  {
+    SweepPoint right = todo.back();
+    if (!left.edge && right.E / left.E - 1 > SWEEP_ADAPTIVE_MIN_WIDTH)
+    {
+      SweepPoint mid = {sqrt(left.E * right.E), 0.0, false};
+      mid.T = SweepPointT(lookup, stack, mid.E, mu);
+      evaluations++;
+      double lnMid = log(max(mid.T, 1e-300)), lnLine = 0.5 * (log(max(left.T, 1e-300)) + log(max(right.T, 1e-300)));
+      if (fabs(lnMid - lnLine) > tol) {todo.push_back(mid); continue;}
+    }
+    todo.pop_back();
+    out.write(buf, snprintf(buf, sizeof(buf), "%.10g %.10g\n", right.E, right.T));
+    left = right;
+  }
+  return evaluations;
+}
@@ -0,0 +1,287 @@
+/*******
+* Table.hh
+*   Parameter-table execution: a macro with $name parameters is compiled once and run for every row of a table.
+*
+* Dependencies:
+*   CalcAtten.hh: Layer, LoadMaterial(), SplitArgs(), ParallelFor() and numThreads
+*   Import.hh: LoadMaterialDB()
+*   Tables.hh: PackTables(), StackLookup and EnergyOrder
+*   Snapshot.hh: RestoreSnapshot()
+*
+* Compiled macros:
+*   Gamma(keV): and Shield(type,cm): become steps of a small program; their numeric arguments may be $name,
+*   taken from the column of that name in each row; absorbers are fixed and loaded once at compile time
+*   Threads:, MaterialDB(file): and Restore(file): are run while compiling, as set-up, and PackTables(numa):
+*   once the whole macro is compiled, so that the packed tables hold every Shield absorber; any other command is
+*   an error, since it has no per-row meaning; MaterialDB and Restore replace materials that compiled Shield
+*   steps use, so they must come before the first Shield
+*   every row starts from I = 1, and its result is the remaining intensity after the last step, with the
+*   coefficients from a StackLookup over the Shield absorbers: the packed tables when PackTables or Restore has
+*   packed them, else log-log interpolated from each material's own table as in StackTransmit()
+*
+* Tables:
+*   CSV: a header line of column names, then one row of numbers per line
+*   binary (any file starting with "CAPARAM1"): ParamTableHeader, then nRows * nCols doubles, row-major;
+*   the file is memory-mapped, so it is never parsed or copied
+*
+* Execution:
+*   rows are run in chunks of TABLE_CHUNK, each chunk step by step across all its rows, with a coefficient
+*   looked up once per chunk when the step's energy is not a parameter, and otherwise for the chunk's rows in
+*   energy order (EnergyOrder, StackLookup::EvalBatch), so each search walks on from the last; chunks run in parallel and are written
+*   in row order, one line per row, "row I"
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <iterator> // istreambuf_iterator for reading a CSV table whole
+#include <cstdio> // snprintf() for the results
+#include <cstring> // memcmp() and strnlen() for the binary header
+#include <fcntl.h> // open() for mapping a binary table
+#include <unistd.h> // read() and close()
+#include <sys/mman.h> // mmap() and munmap()
+#include <sys/stat.h> // fstat() for the mapped file size
+
+const long TABLE_CHUNK = 4096;
+const int PARAM_MAXCOLS = 64;
+
+struct ParamTableHeader
+{
+  char magic[8]; // "CAPARAM1"
+  int nCols;
+  int pad;
+  long nRows;
+  char names[PARAM_MAXCOLS][32];
+};
+
+struct TableStep
+{
+  bool gamma; // set the energy, else attenuate by a layer
+  int layer; // index into CompiledMacro::layers
+  double value; // keV or cm
+  int param; // column of the value, or -1 for the constant
+};
+
+struct CompiledMacro
+{
+  vector<string> params; // parameter names, indexed by TableStep::param
+  vector<TableStep> steps;
+  vector<Layer> layers; // absorber of every Shield step, in order, for the StackLookup
+};
+
+struct ParamTable
+{
+  vector<string> names;
+  long nRows;
+  const double* rows; // [nRows][names.size()]
+  vector<double> storage; // CSV values
+  void* map; // binary file mapping, or NULL
+  size_t mapSize;
+};
+
+int ParamIndex(CompiledMacro& cm, string field, double& value)
+{
+  /*******
+  * Return the parameter index of a $name field, adding it if new, or -1 after setting value from a number
+  *******/
+
+  if (field.empty() || field[0] != '$') {value = stod(field); return -1;}
+  string name = field.substr(1);
+  for (size_t i = 0; i < cm.params.size(); i++) if (cm.params[i] == name) return i;
+  cm.params.push_back(name);
+  return cm.params.size() - 1;
+}
+
+CompiledMacro CompileMacro(string macroFileName)
+{
+  /*******
+  * Compile a macro for table execution; see the header of this file for what it may contain
+  *******/
+
+  ifstream ifs(macroFileName);
+  if (!ifs.is_open()) {cout << "Error: Macro file not open" << endl; exit(EXIT_FAILURE);}
+  CompiledMacro cm;
+  string line, pack; // PackTables argument, run after the loop
+  while (getline(ifs, line))
+  {
+    string::size_type n = line.find(" ");
+    if (n == string::npos) {cout << "Error: Unexpected macro format" << endl; exit(EXIT_FAILURE);}
+    string cmdType = line.substr(0, n), cmdArg = line.substr(n+1);
+    TableStep step;
+    if (cmdType == "Gamma(keV):")
+    {
+      step.gamma = true;
+      step.layer = -1;
+      step.param = ParamIndex(cm, cmdArg, step.value);
+      cm.steps.push_back(step);
+    }
+    else if (cmdType == "Shield(type,cm):")
+    {
+      vector<string> args = SplitArgs(cmdArg);
+      if (args.size() != 2) {cout << "Error: Shield expects type,cm" << endl; exit(EXIT_FAILURE);}
+      if (args[0][0] == '$') {cout << "Error: Absorbers cannot be table parameters" << endl; exit(EXIT_FAILURE);}
+      step.gamma = false;
+      LoadMaterial(args[0]);
+      step.layer = cm.layers.size();
+      cm.layers.push_back(Layer{args[0], 0.0});
+      step.param = ParamIndex(cm, args[1], step.value);
+      cm.steps.push_back(step);
+    }
+    else if (cmdType == "Threads:") numThreads = stoi(cmdArg);
+    else if (cmdType == "PackTables(numa):") pack = cmdArg;
+    else if (cmdType == "MaterialDB(file):" || cmdType == "Restore(file):")
+    {
+      for (size_t s = 0; s < cm.steps.size(); s++)
+        if (!cm.steps[s].gamma) {cout << "Error: " << cmdType << " must come before the first Shield(type,cm): of a table macro" << endl; exit(EXIT_FAILURE);}
+      if (cmdType == "MaterialDB(file):") LoadMaterialDB(cmdArg);
+      else RestoreSnapshot(cmdArg);
+    }
+    else {cout << "Error: " << cmdType << " cannot be run from a parameter table" << endl; exit(EXIT_FAILURE);}
+  }
+  if (cm.steps.empty() || !cm.steps[0].gamma) {cout << "Error: A table macro must start with Gamma(keV):" << endl; exit(EXIT_FAILURE);}
+  if (!pack.empty()) PackTables(pack == "on");
+  return cm;
+}
+
+ParamTable ReadParamTable(string fileName)
+{
+  /*******
+  * Map a binary parameter table, or parse a CSV one in parallel
+  *******/
+
+  ParamTable pt;
+  pt.map = NULL;
+  pt.mapSize = 0;
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {cout << "Error: Parameter table not open" << endl; exit(EXIT_FAILURE);}
+  struct stat st;
+  fstat(fd, &st);
+  char magic[8] = {0};
+  if (read(fd, magic, 8) == 8 && memcmp(magic, "CAPARAM1", 8) == 0)
+  {
+    pt.mapSize = st.st_size;
+    pt.map = mmap(NULL, pt.mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pt.map == MAP_FAILED || pt.mapSize < sizeof(ParamTableHeader)) {cout << "Error: Could not map parameter table" << endl; exit(EXIT_FAILURE);}
+    const ParamTableHeader* h = (const ParamTableHeader*)pt.map;
+    if (h->nCols < 0 || h->nCols > PARAM_MAXCOLS) {cout << "Error: Bad parameter table header" << endl; exit(EXIT_FAILURE);}
+    for (int c = 0; c < h->nCols; c++) pt.names.push_back(string(h->names[c], strnlen(h->names[c], 32)));
+    pt.nRows = h->nRows;
+    pt.rows = (const double*)((const char*)pt.map + sizeof(ParamTableHeader));
+    if (sizeof(ParamTableHeader) + (size_t)pt.nRows * h->nCols * sizeof(double) > pt.mapSize)
+      {cout << "Error: Truncated parameter table" << endl; exit(EXIT_FAILURE);}
+    return pt;
+  }
+  close(fd);
+
+  // CSV: read the whole file, find the line starts, then parse blocks of lines in parallel
+  ifstream in(fileName, ios::binary);
+  string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  string::size_type eol = text.find('\n');
+  string header = text.substr(0, eol);
+  if (!header.empty() && header.back() == '\r') header.pop_back();
+  pt.names = SplitArgs(header);
+  vector<size_t> starts;
+  for (size_t p = (eol == string::npos) ? text.size() : eol + 1; p < text.size(); )
+  {
+    size_t e = text.find('\n', p);
+    if (e == string::npos) e = text.size();
+    if (text.find_first_not_of(" \t\r", p) < e) starts.push_back(p);
+    p = e + 1;
+  }
+  size_t nCols = pt.names.size();
+  pt.nRows = starts.size();
+  pt.storage.resize(pt.nRows * nCols);
+  long nBlocks = (pt.nRows + TABLE_CHUNK - 1) / TABLE_CHUNK;
+  vector<long> bad(nBlocks, -1);
+  ParallelFor(nBlocks, [&](int b)
+  {
+    for (long r = b * TABLE_CHUNK; r < min(pt.nRows, (b + 1) * TABLE_CHUNK); r++)
+    {
+      const char* p = text.c_str() + starts[r];
+      for (size_t c = 0; c < nCols; c++)
+      {
+        char* end;
+        pt.storage[r * nCols + c] = strtod(p, &end);
+        if (end == p) {if (bad[b] < 0) bad[b] = r; break;}
+        p = end;
+        while (*p == ' ' || *p == '\t') p++;
+        if (c + 1 < nCols && *p++ != ',') {if (bad[b] < 0) bad[b] = r; break;}
+      }
+    }
+  });
+  for (long b = 0; b < nBlocks; b++) if (bad[b] >= 0) {cout << "Error: Bad parameter table row " << bad[b] + 1 << endl; exit(EXIT_FAILURE);}
+  pt.rows = pt.storage.data();
+  return pt;
+}
+
+void CloseParamTable(ParamTable& pt)
+{
+  if (pt.map) munmap(pt.map, pt.mapSize);
+  pt.map = NULL;
+}
+
+void RunTable(const CompiledMacro& cm, const ParamTable& pt, string outFile)
+{
+  /*******
+  * Run cm for every row of pt and write "row I" per row to outFile
+  *******/
+
+  // column of every parameter
+  size_t nCols = pt.names.size();
+  vector<int> column(cm.params.size());
+  for (size_t i = 0; i < cm.params.size(); i++)
+  {
+    column[i] = find(pt.names.begin(), pt.names.end(), cm.params[i]) - pt.names.begin();
+    if (column[i] == (int)nCols) {cout << "Error: No column for parameter $" << cm.params[i] << endl; exit(EXIT_FAILURE);}
+  }
+
+  ofstream out(outFile);
+  if (!out.is_open()) {cout << "Error: Table output not open" << endl; exit(EXIT_FAILURE);}
+  StackLookup lookup(cm.layers);
+  long nChunks = (pt.nRows + TABLE_CHUNK - 1) / TABLE_CHUNK;
+  long perRound = 4 * max(1, numThreads > 0 ? numThreads : (int)thread::hardware_concurrency());
+  vector<string> text(perRound);
+  for (long c0 = 0; c0 < nChunks; c0 += perRound)
+  {
+    long nRound = min(perRound, nChunks - c0);
+    ParallelFor(nRound, [&](int k)
+    {
+      long r0 = (c0 + k) * TABLE_CHUNK, n = min(TABLE_CHUNK, pt.nRows - r0);
+      const double* rows = pt.rows + r0 * nCols;
+      vector<double> E(n), I(n, 1.0), mu(n);
+      vector<int> layer(n);
+      bool Econst = true; // all rows of the chunk share the energy
+      EnergyOrder byEnergy; // of the rows, when they do not
+      for (size_t s = 0; s < cm.steps.size(); s++)
+      {
+        const TableStep& step = cm.steps[s];
+        int col = (step.param >= 0) ? column[step.param] : -1;
+        if (step.gamma)
+        {
+          Econst = (col < 0);
+          for (long r = 0; r < n; r++) E[r] = (col < 0) ? step.value : rows[r * nCols + col];
+          if (!Econst) byEnergy.Sort(E.data(), n);
+          continue;
+        }
+        if (Econst)
+        {
+          double mu0 = lookup.EvalOne(E[0], step.layer);
+          workCounters.layers += n;
+          for (long r = 0; r < n; r++) I[r] *= exp(-mu0 * ((col < 0) ? step.value : rows[r * nCols + col]));
+          continue;
+        }
+        fill(layer.begin(), layer.end(), step.layer);
+        lookup.EvalBatch(E.data(), layer.data(), byEnergy.order, mu.data());
+        for (long r = 0; r < n; r++) I[r] *= exp(-mu[r] * ((col < 0) ? step.value : rows[r * nCols + col]));
+      }
+
+      workCounters.energies += n;
+      string& s = text[k];
+      s.clear();
+      char buf[64];
+      for (long r = 0; r < n; r++) s.append(buf, snprintf(buf, sizeof(buf), "%ld %.10g\n", r0 + r, I[r]));
+    });
+    for (long k = 0; k < nRound; k++) out.write(text[k].data(), text[k].size());
+  }
+}
@@ -0,0 +1,340 @@
+/*******
+* Tables.hh
+*   Packed union-grid coefficient tables, optionally replicated per NUMA node on huge pages.
+*
+* Dependencies:
+*   CalcAtten.hh: Material, materialCache, LoadMaterial(), MuRho(), ParallelFor() and workerInit
+*
+* Description:
+*   All loaded materials are resampled onto the union of their energy grids, so that one search finds the
+*   interval for every material at once. An energy where any material has an absorption edge appears twice,
+*   holding each material's value just below and at the edge, so interpolation reproduces LogLogInterp().
+*   Tables are stored as ln(E) and ln(mu) (1/cm, density included) in one block of 2 MB pages: explicit huge
+*   pages if the system has them reserved, otherwise transparent huge pages via madvise().
+*   With replication on, one copy is built per NUMA node by a thread pinned to that node, so that first-touch
+*   places its pages in local memory, and ParallelFor() workers are pinned round-robin to the nodes and read
+*   their node's copy through LocalTables().
+*   Batches of lookups in random energy order (Monte Carlo banks, table rows) are first put in energy order by
+*   EnergyOrder, a radix sort on the leading bits of each energy, and then evaluated in that order, so that the
+*   search for each energy is a short walk on from the previous one and the table rows are read front to back;
+*   results are written back to each query's own slot. The sort only needs to be nearly exact (to a part in
+*   4096): the walk moves either way, and finds the same interval as a binary search, so values are unchanged.
+*
+* Ref:
+*   https://www.kernel.org/doc/html/latest/admin-guide/mm/transhuge.html
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <sched.h> // sched_setaffinity() for pinning workers to a node
+#include <sys/mman.h> // mmap() and madvise() for huge pages
+#include <cstdint> // uint64_t keys for the energy sort
+#include <cstring> // memcpy() of an energy's bits
+
+const size_t HUGE_PAGE_BYTES = 2 << 20;
+const int ORDER_KEY_BITS = 24; // leading bits of an energy sorted on: sign, exponent and 12 mantissa bits
+const int ORDER_DIGIT_BITS = 12;
+
+struct EnergyOrder
+{
+  /*******
+  * Radix sort of a batch of positive energies into (nearly) ascending order; order[k] is the k-th query
+  * Keep one per worker and reuse it from batch to batch, so its buffers are allocated once
+  *******/
+
+  vector<unsigned> keys, keys2;
+  vector<int> order, order2;
+  vector<int> count;
+
+  void Sort(const double* E, size_t n)
+  {
+    keys.resize(n);
+    keys2.resize(n);
+    order.resize(n);
+    order2.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+      uint64_t bits;
+      memcpy(&bits, &E[i], sizeof(bits)); // for positive doubles the bits order as the values do
+      keys[i] = bits >> (64 - ORDER_KEY_BITS);
+      order[i] = i;
+    }
+
+    // least significant digit first; a digit the whole batch shares is skipped
+    int nBuckets = 1 << ORDER_DIGIT_BITS;
+    for (int shift = 0; shift < ORDER_KEY_BITS; shift += ORDER_DIGIT_BITS)
+    {
+      count.assign(nBuckets + 1, 0);
+      for (size_t i = 0; i < n; i++) count[((keys[i] >> shift) & (nBuckets - 1)) + 1]++;
+      if (n == 0 || count[((keys[0] >> shift) & (nBuckets - 1)) + 1] == (int)n) continue;
+      for (int b = 0; b < nBuckets; b++) count[b+1] += count[b];
+      for (size_t i = 0; i < n; i++)
+      {
+        int k = count[(keys[i] >> shift) & (nBuckets - 1)]++;
+        keys2[k] = keys[i];
+        order2[k] = order[i];
+      }
+      keys.swap(keys2);
+      order.swap(order2);
+    }
+  }
+};
+
+struct UnionGrid
+{
+  int nE; // union grid points
+  int nMat;
+  double* lnE; // [nE] ln(E/keV)
+  double* lnMu; // [nMat][nE] ln(mu / (1/cm))
+  void* mem;
+  size_t bytes;
+  size_t mapped; // bytes mapped at mem, unmapped by FreeTables()
+};
+
+vector<string> unionNames; // material of each table row
+vector<UnionGrid> unionReplicas; // one per NUMA node, or a single copy
+vector<vector<int> > nodeCpus; // CPUs of each NUMA node
+thread_local const UnionGrid* localTables = NULL;
+bool unionReplicate = false; // the tables were packed with one copy per NUMA node
+
+void* AllocHuge(size_t bytes, bool& explicitHuge)
+{
+  /*******
+  * Allocate bytes rounded up to whole 2 MB pages, preferring reserved huge pages, else asking for transparent ones
+  *******/
+
+  bytes = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+  void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  explicitHuge = (p != MAP_FAILED);
+  if (explicitHuge) return p;
+  p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {cout << "Error: Could not allocate coefficient tables" << endl; exit(EXIT_FAILURE);}
+  madvise(p, bytes, MADV_HUGEPAGE);
+  return p;
+}
+
+vector<int> ParseCpuList(string list)
+{
+  /*******
+  * Parse a kernel cpulist such as "0-15,32-47"
+  *******/
+
+  vector<int> cpus;
+  vector<string> ranges = SplitArgs(list);
+  for (size_t i = 0; i < ranges.size(); i++)
+  {
+    if (ranges[i].find_first_of("0123456789") == string::npos) continue;
+    string::size_type n = ranges[i].find("-");
+    int lo = stoi(ranges[i].substr(0, n)), hi = (n == string::npos) ? lo : stoi(ranges[i].substr(n+1));
+    for (int c = lo; c <= hi; c++) cpus.push_back(c);
+  }
+  return cpus;
+}
+
+void DetectNodes()
+{
+  /*******
+  * Fill nodeCpus from /sys/devices/system/node; a host without that information counts as one node
+  *******/
+
+  nodeCpus.clear();
+  for (int node = 0; ; node++)
+  {
+    ifstream in("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+    string list;
+    if (!in.is_open() || !getline(in, list)) break;
+    vector<int> cpus = ParseCpuList(list);
+    if (!cpus.empty()) nodeCpus.push_back(cpus);
+  }
+  if (nodeCpus.empty()) nodeCpus.push_back(vector<int>());
+}
+
+void PinToNode(int node)
+{
+  /*******
+  * Restrict the calling thread to the CPUs of node
+  *******/
+
+  if (nodeCpus[node].empty()) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < nodeCpus[node].size(); i++) CPU_SET(nodeCpus[node][i], &set);
+  sched_setaffinity(0, sizeof(set), &set);
+}
+
+void FillUnionGrid(UnionGrid& g, const vector<double>& energies, const vector<bool>& below, bool& explicitHuge)
+{
+  /*******
+  * Allocate g on huge pages and fill it; below[j] marks the first copy of a repeated (edge) energy
+  *******/
+
+  g.nE = energies.size();
+  g.nMat = unionNames.size();
+  g.bytes = (size_t)g.nE * (g.nMat + 1) * sizeof(double);
+  g.mem = AllocHuge(g.bytes, explicitHuge);
+  g.mapped = (g.bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+  g.lnE = (double*)g.mem;
+  g.lnMu = g.lnE + g.nE;
+  for (int j = 0; j < g.nE; j++) g.lnE[j] = log(energies[j]);
+  for (int m = 0; m < g.nMat; m++)
+  {
+    const Material& mat = materialCache[unionNames[m]];
+    for (int j = 0; j < g.nE; j++) g.lnMu[(size_t)m*g.nE + j] = log(MuRho(mat, below[j] ? energies[j] * (1 - 1e-12) : energies[j]));
+  }
+}
+
+void FreeTables()
+{
+  for (size_t r = 0; r < unionReplicas.size(); r++) munmap(unionReplicas[r].mem, unionReplicas[r].mapped);
+  unionReplicas.clear();
+  unionNames.clear();
+  unionReplicate = false;
+  workerInit = nullptr;
+}
+
+void PackTables(bool replicate)
+{
+  /*******
+  * Build the union-grid tables of every loaded material, one copy per NUMA node if replicate is set
+  *******/
+
+  FreeTables();
+  vector<double> energies; // keV
+  vector<bool> below;
+  map<double, int> multiplicity;
+  for (map<string, Material>::iterator it = materialCache.begin(); it != materialCache.end(); it++)
+  {
+    unionNames.push_back(it->first);
+    const vector<double>& Es = it->second.Es;
+    for (size_t j = 0; j < Es.size(); j++)
+    {
+      int count = (j > 0 && Es[j] == Es[j-1]) ? 2 : 1;
+      multiplicity[Es[j] * 1000.] = max(multiplicity[Es[j] * 1000.], count);
+    }
+  }
+  if (unionNames.empty()) {cout << "Error: No materials loaded to pack" << endl; exit(EXIT_FAILURE);}
+  for (map<double, int>::iterator it = multiplicity.begin(); it != multiplicity.end(); it++)
+  {
+    if (it->second == 2) {energies.push_back(it->first); below.push_back(true);}
+    energies.push_back(it->first);
+    below.push_back(false);
+  }
+
+  DetectNodes();
+  int nNodes = replicate ? nodeCpus.size() : 1;
+  unionReplicas.resize(nNodes);
+  vector<char> huge(nNodes, 0);
+  vector<thread> builders;
+  for (int node = 0; node < nNodes; node++)
+  {
+    builders.push_back(thread([&, node]()
+    {
+      if (replicate) PinToNode(node);
+      bool explicitHuge;
+      FillUnionGrid(unionReplicas[node], energies, below, explicitHuge);
+      huge[node] = explicitHuge;
+    }));
+  }
+  for (size_t b = 0; b < builders.size(); b++) builders[b].join();
+
+  unionReplicate = replicate;
+  if (replicate) workerInit = [](int w) {int node = w % unionReplicas.size(); PinToNode(node); localTables = &unionReplicas[node];};
+  cout << "  Packed " << unionNames.size() << " materials on " << energies.size() << " union energies ("
+       << unionReplicas[0].bytes / 1024. << " kB per copy, " << nNodes << " copies, "
+       << (huge[0] ? "reserved" : "transparent") << " huge pages)" << endl;
+}
+
+const UnionGrid* LocalTables()
+{
+  /*******
+  * Return the tables local to the calling thread, or NULL if none have been packed
+  *******/
+
+  if (localTables) return localTables;
+  return unionReplicas.empty() ? NULL : &unionReplicas[0];
+}
+
+struct StackLookup
+{
+  /*******
+  * Linear attenuation coefficients of a fixed list of layers at any energy, for all layers (Eval) or one (EvalOne)
+  * Uses the packed tables (one search for all layers) when every layer's material is in them, else MuRho()
+  * Build it before a ParallelFor(); Eval() is then safe to call from the workers
+  *******/
+
+  vector<const Material*> mats;
+  vector<int> rows; // table row of each layer, or -1
+
+  StackLookup(const vector<Layer>& stack)
+  {
+    for (size_t i = 0; i < stack.size(); i++)
+    {
+      mats.push_back(&LoadMaterial(stack[i].absorber));
+      int row = find(unionNames.begin(), unionNames.end(), stack[i].absorber) - unionNames.begin();
+      rows.push_back(row < (int)unionNames.size() ? row : -1);
+    }
+  }
+
+  double EvalOne(double E, int i) const
+  {
+    const UnionGrid* g = LocalTables();
+    if (g == NULL || rows[i] < 0) return MuRho(*mats[i], E);
+    const double* row = g->lnMu + (size_t)rows[i]*g->nE;
+    double x = log(E);
+    int j = upper_bound(g->lnE, g->lnE + g->nE, x) - g->lnE - 1;
+    if (j < 0) return exp(row[0]);
+    if (j >= g->nE - 1) return exp(row[g->nE - 1]);
+    double f = (x - g->lnE[j]) / (g->lnE[j+1] - g->lnE[j]);
+    return exp(row[j] + f * (row[j+1] - row[j]));
+  }
+
+  void Eval(double E, double* mu) const
+  {
+    const UnionGrid* g = LocalTables();
+    bool packed = (g != NULL);
+    for (size_t i = 0; i < rows.size(); i++) if (rows[i] < 0) packed = false;
+    workCounters.energies++;
+    workCounters.layers += rows.size();
+    if (!packed) {for (size_t i = 0; i < mats.size(); i++) mu[i] = MuRho(*mats[i], E); return;}
+
+    double x = log(E);
+    int j = upper_bound(g->lnE, g->lnE + g->nE, x) - g->lnE - 1;
+    if (j < 0) {for (size_t i = 0; i < rows.size(); i++) mu[i] = exp(g->lnMu[(size_t)rows[i]*g->nE]); return;}
+    if (j >= g->nE - 1) {for (size_t i = 0; i < rows.size(); i++) mu[i] = exp(g->lnMu[(size_t)rows[i]*g->nE + g->nE - 1]); return;}
+    double f = (x - g->lnE[j]) / (g->lnE[j+1] - g->lnE[j]);
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+      const double* row = g->lnMu + (size_t)rows[i]*g->nE;
+      mu[i] = exp(row[j] + f * (row[j+1] - row[j]));
+    }
+  }
+
+  void EvalBatch(const double* E, const int* layer, const vector<int>& order, double* mu) const
+  {
+    /*******
+    * mu[i] = EvalOne(E[i], layer[i]) for every query i, taken in the order of an EnergyOrder of E
+    *******/
+
+    const UnionGrid* g = LocalTables();
+    int j = -1; // last union energy at or below x, as upper_bound() - 1 would give
+    vector<size_t> at(mats.size(), 1); // interval in each layer's own grid, for layers not in the tables
+    workCounters.layers += order.size();
+    for (size_t k = 0; k < order.size(); k++)
+    {
+      int i = order[k], l = layer[i];
+      if (g == NULL || rows[l] < 0) {mu[i] = LogLogInterpFrom(mats[l]->Es, mats[l]->MACs, E[i]/1000., at[l]) * mats[l]->density; continue;}
+      double x = log(E[i]);
+      while (j + 1 < g->nE && g->lnE[j+1] <= x) j++;
+      while (j >= 0 && g->lnE[j] > x) j--;
+      const double* row = g->lnMu + (size_t)rows[l]*g->nE;
+      if (j < 0) mu[i] = exp(row[0]);
+      else if (j >= g->nE - 1) mu[i] = exp(row[g->nE - 1]);
+      else
+      {
+        double f = (x - g->lnE[j]) / (g->lnE[j+1] - g->lnE[j]);
+        mu[i] = exp(row[j] + f * (row[j+1] - row[j]));
+      }
+    }
+  }
+};
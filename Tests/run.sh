@@ -0,0 +1,164 @@
+#!/bin/bash
+#*******
+# run.sh
+#   Reference checks for CalcAtten: every macro in Tests/ is run and its output compared with Tests/ref/.
+#
+# Usage (from anywhere):
+#   Tests/run.sh            build Tests/out/CalcAtten, run every check, and exit non-zero if any fails
+#   Tests/run.sh --update   rewrite Tests/ref/ from this build (review the diff before committing it)
+#
+# Checks:
+#   reference: Tests/<name>.mac is run from the repository root, writing into Tests/out/<name>/; its output,
+#   with run times and machine-dependent details removed (see Filter), followed by the text of every file it
+#   wrote (the size of binary ones), must match Tests/ref/<name>.txt; likewise the parameter-table run of
+#   Tests/data/rows.mac and the planned work of --plan
+#   same output: runs that must not differ in anything but timing, i.e. 1 and 4 threads, 0 and 3 worker
+#   processes (one of them slowed, so shards are re-run), a sweep before and after a snapshot is restored, a
+#   parameter table with and without packed tables, and every macro run directly and through a zygote
+#   agreement: numbers that must agree within a tolerance: history- and event-based Transport, adjoint and
+#   forward Transport of a diffuse source, S_N and Monte Carlo backscatter from a lead slab, and the lines
+#   unfolded from a synthetic spectrum with those it was made from
+#   reference outputs are for this build (g++ -O2) on x86-64; another compiler may differ in the last digits
+#
+# Author:
+#   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+#*******
+
+cd "$(dirname "$0")/.." || exit 1
+update=0
+[ "$1" == "--update" ] && update=1
+out=Tests/out
+bin=$out/CalcAtten
+failures=0
+mkdir -p $out Tests/ref
+g++ -g -O2 -Wall -pthread -o$bin CalcAtten.cc || exit 1
+
+# drop run times and what depends on the machine rather than the physics
+Filter()
+{
+  sed -E -e '/^  [0-9.e+-]+ s$/d' -e '/histories\/s$/d' -e '/ us each\)$/d' -e '/straggling shards/d' \
+         -e 's/ \([0-9.]+ kB per copy.*\)$//'
+}
+
+# filtered output of a run, then the files it wrote
+Dump()
+{
+  Filter < "$1"
+  for f in $(ls "$2" 2>/dev/null | sort); do
+    if grep -qI . "$2/$f" || [ ! -s "$2/$f" ]; then echo "==> $f <=="; cat "$2/$f"
+    else echo "==> $f <== binary, $(wc -c < "$2/$f") bytes"; fi
+  done
+}
+
+Fail()
+{
+  echo "FAIL $1"
+  failures=$((failures + 1))
+}
+
+# compare a dump with its reference, or write the reference
+Reference()
+{
+  if [ $update == 1 ]; then cp "$2" "Tests/ref/$1.txt"; echo "updated $1"
+  elif diff -u "Tests/ref/$1.txt" "$2" > $out/$1.diff; then echo "ok   $1"
+  else Fail "$1 (see $out/$1.diff)"; fi
+}
+
+Same()
+{
+  if cmp -s "$2" "$3"; then echo "ok   $1"; else Fail "$1: $2 and $3 differ"; diff "$2" "$3" | head -20; fi
+}
+
+# Close label a b tol: |a - b| <= tol * |b|
+Close()
+{
+  if awk -v a="$2" -v b="$3" -v t="$4" 'BEGIN {d = a - b; if (d < 0) d = -d; if (b < 0) b = -b; exit !(a != "" && d <= t * b)}'
+  then echo "ok   $1 ($2 vs $3)"; else Fail "$1: $2 vs $3 not within $4"; fi
+}
+
+# Run name prefix: run Tests/<name>.mac with the prefix lines in front into $out/<name>/, and dump it
+Run()
+{
+  local name=$1 tag=$2 prefix=$3
+  rm -rf $out/$name; mkdir -p $out/$name
+  { [ -n "$prefix" ] && printf "$prefix"; cat Tests/$name.mac; } > $out/$name.$tag.mac
+  $bin $out/$name.$tag.mac > $out/$name.$tag.log 2>&1 || Fail "$name ($tag) exited with $?"
+  sed "s#$out/$name.$tag.mac#Tests/$name.mac#" $out/$name.$tag.log > $out/$name.$tag.log.tmp
+  mv $out/$name.$tag.log.tmp $out/$name.$tag.log
+  rm -f $out/$name.$tag.mac
+  Dump $out/$name.$tag.log $out/$name > $out/$name.$tag.txt
+}
+
+macros=$(cd Tests && ls *.mac | sed 's/\.mac$//')
+
+# reference outputs
+for name in $macros; do
+  Run $name direct
+  Reference $name $out/$name.direct.txt
+done
+rm -rf $out/table; mkdir -p $out/table
+$bin Tests/data/rows.mac --table Tests/data/rows.csv $out/table/results.txt > $out/table.log 2>&1 || Fail "table exited with $?"
+Dump $out/table.log $out/table > $out/table.txt
+Reference table $out/table.txt
+{ for name in sweep transport identify; do $bin Tests/$name.mac --plan | grep -E "^Plan for|Materials to load|Layer evaluations"; done
+  $bin Tests/data/rows.mac --table Tests/data/rows.csv $out/table/results.txt --plan | grep -E "^Plan for|rows x"; } 2>&1 \
+  | sed 's/ (nothing run.*$//' > $out/plan.txt
+Reference plan $out/plan.txt
+[ $update == 1 ] && exit 0
+
+# same output: thread count, worker processes, snapshot restore, packed tables
+for name in pareto dosemap transport adjoint sweep unfold; do
+  Run $name threads1 "Threads: 1\n"
+  Run $name threads4 "Threads: 4\n"
+  Same "$name with 1 and 4 threads" $out/$name.threads1.txt $out/$name.threads4.txt
+done
+for name in sweep batch transport; do
+  Run $name workers0 ""
+  CALCATTEN_SLOW_WORKER=0,0.05 Run $name workers3 "Workers: 3\n"
+  Same "$name with 0 and 3 worker processes" $out/$name.workers0.txt $out/$name.workers3.txt
+done
+Run snapshot direct
+Same "sweep before and after Restore" $out/snapshot/before.txt $out/snapshot/after.txt
+{ echo "PackTables(numa): off"; cat Tests/data/rows.mac; } > $out/rows.packed.mac
+$bin $out/rows.packed.mac --table Tests/data/rows.csv $out/table.packed.txt > $out/table.packed.log 2>&1 || Fail "packed table exited with $?"
+Same "parameter table with and without PackTables" $out/table/results.txt $out/table.packed.txt
+
+# same output through a zygote, which also traces every request as slow
+pkill -f "^$bin --zygote" 2>/dev/null
+CALCATTEN_SLOW=0 $bin --zygote $out/zygote.sock > $out/zygote.log 2>&1 &
+zygote=$!
+for i in $(seq 50); do [ -S $out/zygote.sock ] && break; sleep 0.1; done
+for name in $macros; do
+  CALCATTEN_ZYGOTE=$out/zygote.sock Run $name zygote
+  Same "$name through the zygote" $out/$name.direct.txt $out/$name.zygote.txt
+done
+CALCATTEN_ZYGOTE=$out/zygote.sock $bin --slow-requests > $out/slow.txt 2>&1
+grep -q "Sweep" $out/slow.txt && echo "ok   slow-request traces" || Fail "slow-request traces: no Sweep span in $out/slow.txt"
+kill $zygote; wait $zygote 2>/dev/null
+
+# agreement: history- and event-based Transport of the same problem
+T=($(grep "^  Transmitted" $out/transport.direct.log | sed -E 's/^  Transmitted ([0-9.e+-]+).*reflected ([0-9.e+-]+).*/\1 \2/'))
+Close "event and history Transport, transmitted" "${T[0]}" "${T[2]}" 0.04
+Close "event and history Transport, reflected" "${T[1]}" "${T[3]}" 0.15
+
+# agreement: energy deposited in the detector layer by a diffuse source, adjoint against forward Transport
+A=$(grep "per entering photon" $out/adjoint.direct.log | sed -E 's/.*per entering photon: ([0-9.e+-]+) .*/\1/')
+F=$(grep "^  Energy deposited in layer 1 (Ge): " $out/adjoint.direct.log | sed -E 's/.*: ([0-9.e+-]+) .*/\1/')
+Close "adjoint and forward Transport of a diffuse source" "$A" "$F" 0.03
+
+# agreement: photons reflected from a lead slab, S_N against Monte Carlo, at 662 and 1332 keV
+S=($(grep "per incident photon" $out/backscatter.direct.log | sed -E 's/.*reflected ([0-9.e+-]+) per.*/\1/'))
+M=($(grep "^  Transmitted [0-9]" $out/backscatter.direct.log | sed -E 's/.*reflected ([0-9.e+-]+),.*/\1/'))
+Close "S_N and Monte Carlo backscatter from lead at 662 keV" "${S[0]}" "${M[0]}" 0.15
+Close "S_N and Monte Carlo backscatter from lead at 1332 keV" "${S[1]}" "${M[1]}" 0.15
+
+# agreement: the unfolded source has the lines Tests/data/measured.txt was made from
+L=($(awk '{if ($1 >= 100 && $1 <= 145) a += $2; if ($1 >= 630 && $1 <= 695) b += $2; if ($1 >= 1140 && $1 <= 1205) c += $2;
+           if ($1 >= 1300 && $1 <= 1365) d += $2} END {print a, b, c, d}' $out/unfold/source.txt))
+Close "unfolded 122 keV line" "${L[0]}" 4000 0.03
+Close "unfolded 662 keV line" "${L[1]}" 10000 0.03
+Close "unfolded 1173 keV line" "${L[2]}" 6000 0.03
+Close "unfolded 1332 keV line" "${L[3]}" 6000 0.03
+
+echo "$failures failed"
+[ $failures == 0 ]
@@ -0,0 +1,124 @@
+/*******
+* Trajectory.hh
+*   Dose integrated along a piecewise-linear trajectory past a nested-shell shield.
+*
+* Dependencies:
+*   CalcAtten.hh: ParallelFor()
+*   Geometry.hh: ShieldModel and DoseRate()
+*
+* Description:
+*   Waypoints (x, y, z, t) are given in the frame where the shield is centred on the origin and the source
+*   sits at its fixed position inside the cavity.
+*   detector mode: the waypoints are the detector positions as it is moved past the shielded source
+*   source mode: the waypoints are the positions of the shield origin as the shielded source is moved past a
+*   fixed detector, so the detector is seen at detector - waypoint
+*   Each segment is integrated over time with adaptive Simpson quadrature, segments in parallel.
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+struct Waypoint
+{
+  double x[3]; // cm
+  double t; // s
+};
+
+struct TrajectoryResult
+{
+  double dose; // Gy
+  double peakRate; // Gy/h, over the sampled points
+  long evaluations;
+};
+
+struct TrajectoryLeg
+{
+  const ShieldModel* model;
+  const double* src;
+  const double* detector; // NULL in detector mode
+  double activity;
+  Waypoint a, b;
+  long evaluations;
+  double peakRate;
+
+  double Rate(double t)
+  {
+    /*******
+    * Return the dose rate (Gy/s) at time t within the leg
+    *******/
+
+    double f = (b.t > a.t) ? (t - a.t) / (b.t - a.t) : 0.0, pt[3];
+    for (int i = 0; i < 3; i++)
+    {
+      double x = a.x[i] + f * (b.x[i] - a.x[i]);
+      pt[i] = detector ? detector[i] - x : x;
+    }
+    double rate = DoseRate(*model, src, pt, activity);
+    evaluations++;
+    peakRate = max(peakRate, rate);
+    return rate / 3600.;
+  }
+
+  double Simpson(double t0, double t1, double f0, double fm, double f1, double whole, double tol, int depth)
+  {
+    /*******
+    * Adaptive Simpson on [t0, t1], given the rate at both ends and the midpoint and the Simpson estimate whole
+    *******/
+
+    double tm = 0.5 * (t0 + t1), tl = 0.5 * (t0 + tm), tr = 0.5 * (tm + t1);
+    double fl = Rate(tl), fr = Rate(tr);
+    double left = (tm - t0) / 6 * (f0 + 4*fl + fm), right = (t1 - tm) / 6 * (fm + 4*fr + f1);
+    if (depth <= 0 || fabs(left + right - whole) <= 15 * tol) return left + right + (left + right - whole) / 15;
+    return Simpson(t0, tm, f0, fl, fm, left, tol/2, depth - 1) + Simpson(tm, t1, fm, fr, f1, right, tol/2, depth - 1);
+  }
+};
+
+TrajectoryResult IntegrateTrajectory(const ShieldModel& model, const double* src, const double* detector, double activity,
+                                     const vector<Waypoint>& path, double relTol)
+{
+  /*******
+  * Return the dose collected along path; detector is NULL in detector mode, see the header of this file
+  * relTol is relative to a first estimate of the total dose from 16 samples per leg
+  *******/
+
+  // split each leg into pieces for load balance, and get a first estimate of the total for the tolerance
+  const int pieces = 16;
+  int nLegs = path.size() - 1;
+  vector<TrajectoryLeg> legs;
+  for (int i = 0; i < nLegs; i++)
+  {
+    for (int p = 0; p < pieces; p++)
+    {
+      TrajectoryLeg leg = {&model, src, detector, activity, path[i], path[i+1], 0, 0.0};
+      for (int a = 0; a < 3; a++)
+      {
+        leg.a.x[a] = path[i].x[a] + (path[i+1].x[a] - path[i].x[a]) * p / pieces;
+        leg.b.x[a] = path[i].x[a] + (path[i+1].x[a] - path[i].x[a]) * (p + 1) / pieces;
+      }
+      leg.a.t = path[i].t + (path[i+1].t - path[i].t) * p / pieces;
+      leg.b.t = path[i].t + (path[i+1].t - path[i].t) * (p + 1) / pieces;
+      legs.push_back(leg);
+    }
+  }
+  double estimate = 0.0;
+  for (size_t j = 0; j < legs.size(); j++) estimate += 0.5 * (legs[j].Rate(legs[j].a.t) + legs[j].Rate(legs[j].b.t)) * (legs[j].b.t - legs[j].a.t);
+  double tol = max(relTol * estimate, 1e-300) / legs.size();
+
+  vector<double> dose(legs.size());
+  ParallelFor(legs.size(), [&](int j)
+  {
+    TrajectoryLeg& leg = legs[j];
+    double t0 = leg.a.t, t1 = leg.b.t, tm = 0.5 * (t0 + t1);
+    double f0 = leg.Rate(t0), fm = leg.Rate(tm), f1 = leg.Rate(t1);
+    dose[j] = leg.Simpson(t0, t1, f0, fm, f1, (t1 - t0) / 6 * (f0 + 4*fm + f1), tol, 30);
+  });
+
+  TrajectoryResult res = {0.0, 0.0, 0};
+  for (size_t j = 0; j < legs.size(); j++)
+  {
+    res.dose += dose[j];
+    res.peakRate = max(res.peakRate, legs[j].peakRate);
+    res.evaluations += legs[j].evaluations;
+  }
+  return res;
+}
@@ -0,0 +1,517 @@
+/*******
+* Transport.hh
+*   Analog Monte Carlo photon transport of a pencil beam through a slab stack, history- or event-based.
+*
+* Dependencies:
+*   CalcAtten.hh: Layer and ParallelFor()
+*   Scatter.hh: ComptonEnergy(), KleinNishinaTotal(), ElectronDensity() and ELECTRON_MASS_KEV
+*   Tables.hh: StackLookup and EnergyOrder
+*   Shard.hh: RunSharded(), ShardSize(), PutDoubles(), GetDoubles() and numWorkers
+*
+* Physics:
+*   the beam enters the first layer at z = 0 along +z, or with diffuse incidence from an isotropic flux outside
+*   (cosine-law directions); slabs are infinite in x and y, outside is void
+*   total attenuation comes from the loaded tables; Compton scattering uses Klein-Nishina on free electrons
+*   (Kahn's sampling), and every other interaction (photoelectric, pair, coherent) is taken as local absorption
+*   the Compton electron and absorbed photons deposit their energy where they interact; photons below the
+*   cutoff energy are absorbed
+*
+* Scheduling:
+*   histories are split into batches of TRANSPORT_BATCH, each with its own generator seeded from (seed, batch),
+*   and batches run in parallel, so results do not depend on the thread count
+*   history mode follows one photon at a time to its end
+*   event mode keeps a batch in a structure-of-arrays bank and repeatedly processes every particle waiting for
+*   the same event type (free flight, layer crossing, Compton, photoabsorption) as one tight loop; with
+*   surface tracking the cross sections of the whole bank are looked up in energy order (EnergyOrder)
+*
+* Tallies:
+*   every batch scores into its own TransportTally, so workers never share a counter; batches are merged in
+*   batch order, which makes the totals independent of the thread count and of which worker ran which batch
+*   histograms: energy deposited per layer, spectrum of the transmitted photons, cosine of the exit direction
+*   (negative for reflected photons), and the pulse-height spectrum of the last layer, taken as the detector
+*   (e.g. a Ge crystal behind the shield): the energy each source photon deposits there, if any
+*   the merge keeps the sum over batches of each bin and of its square, giving the relative error of every bin
+*   from the spread of the batch results
+*   batches run in rounds; with checkpoints on, a round is that many batches and the merged totals are handed
+*   to a callback after each, otherwise rounds are TALLY_ROUND batches, which bounds the tally memory
+*   with Workers on, the batches of a round are sharded across worker processes, which send back every batch's
+*   tally; the merge is the same, in batch order, so the totals match a run in one process exactly
+*
+* Tracking:
+*   surface tracking stops every flight at the next layer boundary and resamples with that layer's coefficient
+*   delta (Woodcock) tracking samples flights with a majorant, the largest mu(E) of any layer material, ignores
+*   boundaries, and accepts a collision at z as real with probability mu(z, E) / majorant; a virtual collision
+*   leaves the photon unchanged, so the answer is the same but no boundary distances are needed, which pays off
+*   when a stack has many thin layers
+*   the majorant is piecewise constant between the points of the materials' energy grids; log-log interpolation
+*   is monotone between grid points, so the larger end value of each material bounds it over the interval
+*
+* Ref:
+*   H. Kahn, "Applications of Monte Carlo", AECU-3259 (1954)
+*   F. B. Brown and W. R. Martin, "Monte Carlo methods for radiation transport analysis on vector computers",
+*   Prog. Nucl. Energy 14 (1984) 269
+*   E. R. Woodcock et al., "Techniques used in the GEM code for Monte Carlo neutronics calculations in reactors
+*   and other systems of complex geometry", ANL-7050 (1965) 557
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <random> // mt19937_64 for the per-batch generators
+#include <chrono> // timing the run
+
+const long TRANSPORT_BATCH = 10000;
+const long TALLY_ROUND = 1024; // batches per round without checkpoints
+
+struct TransportConfig
+{
+  double E0; // beam energy (keV)
+  double Ecut; // cutoff energy (keV)
+  long histories;
+  unsigned long seed;
+  bool eventBased;
+  bool delta; // Woodcock delta tracking instead of surface tracking
+  bool diffuse; // cosine-law incidence instead of a normal beam
+  int bins; // histogram bins of the spectra
+  long checkpoint; // batches between checkpoints, 0 for none
+};
+
+struct Histogram
+{
+  /*******
+  * Fixed-width histogram; while a batch runs, sum holds its scores, and after merging the sums over batches
+  *******/
+
+  double lo, width;
+  vector<double> sum, sum2; // sum2: sum over batches of the squared batch score
+  long batches;
+
+  Histogram() : lo(0.0), width(1.0), batches(0) {}
+  Histogram(int n, double lo0, double hi) : lo(lo0), width((hi - lo0) / n), sum(n, 0.0), sum2(n, 0.0), batches(0) {}
+
+  void Score(double x, double w)
+  {
+    int i = (int)floor((x - lo) / width);
+    if (i == (int)sum.size() && x <= lo + width * sum.size()) i--; // the top edge belongs to the last bin
+    if (i >= 0 && i < (int)sum.size()) sum[i] += w;
+  }
+
+  void Merge(const Histogram& batch)
+  {
+    for (size_t i = 0; i < sum.size(); i++) {sum[i] += batch.sum[i]; sum2[i] += batch.sum[i] * batch.sum[i];}
+    batches++;
+  }
+
+  double RelError(int i) const
+  {
+    if (batches < 2 || sum[i] == 0.0) return 0.0;
+    double mean = sum[i] / batches, var = (sum2[i] / batches - mean * mean) / (batches - 1);
+    return sqrt(max(0.0, var)) / mean;
+  }
+};
+
+struct TransportTally
+{
+  long transmitted, uncollided, reflected, absorbed;
+  double eTransmitted, eReflected; // keV
+  Histogram edep; // keV deposited, one bin per layer
+  Histogram spectrum; // transmitted photons by energy (keV)
+  Histogram exitCos; // escaping photons by direction cosine, -1 to 1
+  Histogram pulseHeight; // source photons by energy deposited in the last layer (keV)
+
+  TransportTally() {}
+  TransportTally(int nLayers, const TransportConfig& cfg) : transmitted(0), uncollided(0), reflected(0), absorbed(0),
+    eTransmitted(0.0), eReflected(0.0), edep(nLayers, 0, nLayers), spectrum(cfg.bins, 0, cfg.E0),
+    exitCos(cfg.bins, -1, 1), pulseHeight(cfg.bins, 0, cfg.E0) {}
+
+  void Add(const TransportTally& batch)
+  {
+    transmitted += batch.transmitted;
+    uncollided += batch.uncollided;
+    reflected += batch.reflected;
+    absorbed += batch.absorbed;
+    eTransmitted += batch.eTransmitted;
+    eReflected += batch.eReflected;
+    edep.Merge(batch.edep);
+    spectrum.Merge(batch.spectrum);
+    exitCos.Merge(batch.exitCos);
+    pulseHeight.Merge(batch.pulseHeight);
+  }
+
+  void Pack(string& out) const
+  {
+    long counts[4] = {transmitted, uncollided, reflected, absorbed};
+    double energies[2] = {eTransmitted, eReflected};
+    out.append((const char*)counts, sizeof(counts));
+    PutDoubles(out, energies, 2);
+    const Histogram* h[4] = {&edep, &spectrum, &exitCos, &pulseHeight};
+    for (int k = 0; k < 4; k++) PutDoubles(out, h[k]->sum.data(), h[k]->sum.size());
+  }
+
+  void Unpack(const char*& in)
+  {
+    long counts[4];
+    double energies[2];
+    memcpy(counts, in, sizeof(counts));
+    in += sizeof(counts);
+    GetDoubles(in, energies, 2);
+    transmitted = counts[0]; uncollided = counts[1]; reflected = counts[2]; absorbed = counts[3];
+    eTransmitted = energies[0]; eReflected = energies[1];
+    Histogram* h[4] = {&edep, &spectrum, &exitCos, &pulseHeight};
+    for (int k = 0; k < 4; k++) GetDoubles(in, h[k]->sum.data(), h[k]->sum.size());
+  }
+};
+
+struct SlabProblem
+{
+  vector<double> zb; // layer boundaries (cm)
+  vector<double> ne; // electron density per layer (1/cm^3)
+  StackLookup lookup;
+  vector<double> majE; // keV, lower end of each majorant interval
+  vector<double> majMu; // 1/cm, majorant over [majE[j], majE[j+1])
+
+  SlabProblem(const vector<Layer>& stack) : lookup(stack)
+  {
+    zb.push_back(0.0);
+    for (size_t i = 0; i < stack.size(); i++)
+    {
+      zb.push_back(zb.back() + stack[i].thickness);
+      ne.push_back(ElectronDensity(*lookup.mats[i]));
+    }
+
+    // majorant from the material tables: the largest end value of any material on each grid interval
+    // values outside a material's grid are clamped, so the first and last intervals also cover the ends
+    vector<double> grid;
+    for (size_t i = 0; i < lookup.mats.size(); i++)
+      for (size_t j = 0; j < lookup.mats[i]->Es.size(); j++) grid.push_back(lookup.mats[i]->Es[j] * 1000.);
+    sort(grid.begin(), grid.end());
+    grid.erase(unique(grid.begin(), grid.end()), grid.end());
+    size_t nIntervals = grid.size() > 1 ? grid.size() - 1 : grid.size();
+    for (size_t j = 0; j < nIntervals; j++)
+    {
+      double lo = grid[j], hi = (j + 1 < grid.size()) ? grid[j+1] : grid[j], mu = 0.0;
+      for (size_t i = 0; i < lookup.mats.size(); i++)
+        mu = max(mu, max(MuRho(*lookup.mats[i], lo), MuRho(*lookup.mats[i], hi * (1 - 1e-12))));
+      majE.push_back(lo);
+      majMu.push_back(mu * (1 + 1e-9));
+    }
+  }
+
+  double Majorant(double E) const
+  {
+    int j = upper_bound(majE.begin(), majE.end(), E) - majE.begin() - 1;
+    return majMu[max(j, 0)];
+  }
+
+  int LayerAt(double z) const
+  {
+    return upper_bound(zb.begin() + 1, zb.end() - 1, z) - zb.begin() - 1;
+  }
+};
+
+double SampleCompton(double E, mt19937_64& rng, double& cosTheta)
+{
+  /*******
+  * Sample a Klein-Nishina scatter of a photon of energy E (keV) by Kahn's method; return E' and set cos(theta)
+  *******/
+
+  uniform_real_distribution<double> unif(0.0, 1.0);
+  double k = E / ELECTRON_MASS_KEV;
+  while (true)
+  {
+    double r1 = unif(rng), r2 = unif(rng), r3 = unif(rng), x;
+    if (r1 <= (1 + 2*k) / (9 + 2*k))
+    {
+      x = 1 + 2*k*r2;
+      if (r3 > 4 * (1/x - 1/(x*x))) continue;
+    }
+    else
+    {
+      x = (1 + 2*k) / (1 + 2*k*r2);
+      double c = 1 - (x - 1) / k;
+      if (r3 > 0.5 * (c*c + 1/x)) continue;
+    }
+    cosTheta = 1 - (x - 1) / k;
+    return E / x;
+  }
+}
+
+double RotateDirection(double u, double cosTheta, mt19937_64& rng)
+{
+  /*******
+  * Return the new z direction cosine after scattering through theta with a uniform azimuth
+  *******/
+
+  uniform_real_distribution<double> unif(0.0, 1.0);
+  double phi = 2 * M_PI * unif(rng);
+  double sinTheta = sqrt(max(0.0, 1 - cosTheta*cosTheta));
+  double w = u * cosTheta + sqrt(max(0.0, 1 - u*u)) * sinTheta * cos(phi);
+  return min(1.0, max(-1.0, w));
+}
+
+void RunHistoryBatch(const SlabProblem& p, const TransportConfig& cfg, long n, mt19937_64& rng, TransportTally& tally)
+{
+  /*******
+  * Follow n photons, one at a time
+  *******/
+
+  uniform_real_distribution<double> unif(0.0, 1.0);
+  int nLayers = p.ne.size();
+  for (long h = 0; h < n; h++)
+  {
+    double z = 0.0, u = cfg.diffuse ? sqrt(1 - unif(rng)) : 1.0, E = cfg.E0, deposit = 0.0; // deposit: in the last layer
+    int layer = 0;
+    bool collided = false;
+    while (true)
+    {
+      double mut;
+      if (cfg.delta)
+      {
+        double sigM = p.Majorant(E);
+        z += -log(1 - unif(rng)) / sigM * u;
+        if (z >= p.zb[nLayers]) {tally.transmitted++; tally.eTransmitted += E; if (!collided) tally.uncollided++; tally.spectrum.Score(E, 1); tally.exitCos.Score(u, 1); break;}
+        if (z < 0) {tally.reflected++; tally.eReflected += E; tally.exitCos.Score(u, 1); break;}
+        layer = p.LayerAt(z);
+        mut = p.lookup.EvalOne(E, layer);
+        if (unif(rng) * sigM >= mut) continue; // virtual collision
+      }
+      else
+      {
+        mut = p.lookup.EvalOne(E, layer);
+        double dist = -log(1 - unif(rng)) / mut;
+        double toBoundary = u > 0 ? (p.zb[layer+1] - z) / u : (u < 0 ? (p.zb[layer] - z) / u : 1e300);
+        if (dist >= toBoundary)
+        {
+          z = u > 0 ? p.zb[layer+1] : p.zb[layer];
+          layer += u > 0 ? 1 : -1;
+          if (layer == nLayers) {tally.transmitted++; tally.eTransmitted += E; if (!collided) tally.uncollided++; tally.spectrum.Score(E, 1); tally.exitCos.Score(u, 1); break;}
+          if (layer < 0) {tally.reflected++; tally.eReflected += E; tally.exitCos.Score(u, 1); break;}
+          continue;
+        }
+        z += dist * u;
+      }
+      collided = true;
+      double muc = p.ne[layer] * KleinNishinaTotal(E);
+      double E1 = 0.0, cosTheta;
+      if (unif(rng) * mut < muc) E1 = SampleCompton(E, rng, cosTheta);
+      if (E1 < cfg.Ecut) // photoabsorption, or scattered below the cutoff
+      {
+        tally.edep.sum[layer] += E;
+        if (layer == nLayers - 1) deposit += E;
+        tally.absorbed++;
+        break;
+      }
+      tally.edep.sum[layer] += E - E1;
+      if (layer == nLayers - 1) deposit += E - E1;
+      u = RotateDirection(u, cosTheta, rng);
+      E = E1;
+    }
+    if (deposit > 0) tally.pulseHeight.Score(deposit, 1);
+  }
+}
+
+struct ParticleBank
+{
+  /*******
+  * Structure-of-arrays store of the live photons of one batch
+  *******/
+
+  vector<double> z, u, E, mut;
+  vector<double> deposit; // keV deposited in the last layer so far
+  vector<int> layer;
+  vector<char> collided;
+
+  void Resize(size_t n) {z.resize(n); u.resize(n); E.resize(n); mut.resize(n); deposit.resize(n); layer.resize(n); collided.resize(n);}
+  void Move(size_t from, size_t to)
+  {
+    z[to] = z[from]; u[to] = u[from]; E[to] = E[from]; mut[to] = mut[from]; deposit[to] = deposit[from];
+    layer[to] = layer[from]; collided[to] = collided[from];
+  }
+};
+
+void RunEventBatch(const SlabProblem& p, const TransportConfig& cfg, long n, mt19937_64& rng, TransportTally& tally)
+{
+  /*******
+  * Transport n photons together, one event type at a time, until the bank is empty
+  *******/
+
+  uniform_real_distribution<double> unif(0.0, 1.0);
+  int nLayers = p.ne.size();
+  ParticleBank bank;
+  bank.Resize(n);
+  for (long i = 0; i < n; i++) {bank.z[i] = 0.0; bank.u[i] = cfg.diffuse ? sqrt(1 - unif(rng)) : 1.0; bank.E[i] = cfg.E0; bank.deposit[i] = 0.0; bank.layer[i] = 0; bank.collided[i] = 0;}
+  size_t live = n;
+  vector<int> crossing, collision, compton, absorption;
+  vector<double> dist(n);
+  vector<char> dead(n);
+  EnergyOrder byEnergy;
+
+  while (live > 0)
+  {
+    // cross-section lookup for the whole bank (the majorant with delta tracking, whose grid is too small for
+    // the energy order to pay)
+    if (cfg.delta) for (size_t i = 0; i < live; i++) bank.mut[i] = p.Majorant(bank.E[i]);
+    else
+    {
+      byEnergy.Sort(bank.E.data(), live);
+      p.lookup.EvalBatch(bank.E.data(), bank.layer.data(), byEnergy.order, bank.mut.data());
+    }
+
+    // free-flight event: sample a distance and sort each particle into the crossing or collision queue
+    // (with delta tracking, crossing means leaving the stack)
+    crossing.clear();
+    collision.clear();
+    for (size_t i = 0; i < live; i++) dist[i] = -log(1 - unif(rng)) / bank.mut[i];
+    if (cfg.delta)
+      for (size_t i = 0; i < live; i++)
+      {
+        double z = bank.z[i] + dist[i] * bank.u[i];
+        if (z >= p.zb[nLayers] || z < 0) crossing.push_back(i); else collision.push_back(i);
+      }
+    else
+      for (size_t i = 0; i < live; i++)
+      {
+        double u = bank.u[i];
+        double toBoundary = u > 0 ? (p.zb[bank.layer[i]+1] - bank.z[i]) / u : (u < 0 ? (p.zb[bank.layer[i]] - bank.z[i]) / u : 1e300);
+        if (dist[i] >= toBoundary) crossing.push_back(i); else collision.push_back(i);
+      }
+
+    // layer-crossing event
+    for (size_t k = 0; k < crossing.size(); k++)
+    {
+      int i = crossing[k];
+      bool up = bank.u[i] > 0;
+      if (cfg.delta) bank.layer[i] = up ? nLayers - 1 : 0; // leaves through the outer face of this layer
+      bank.z[i] = up ? p.zb[bank.layer[i]+1] : p.zb[bank.layer[i]];
+      bank.layer[i] += up ? 1 : -1;
+      dead[i] = 0;
+      if (bank.layer[i] == nLayers || bank.layer[i] < 0) {tally.exitCos.Score(bank.u[i], 1); dead[i] = 1;}
+      if (bank.layer[i] == nLayers) {tally.transmitted++; tally.eTransmitted += bank.E[i]; if (!bank.collided[i]) tally.uncollided++; tally.spectrum.Score(bank.E[i], 1);}
+      else if (bank.layer[i] < 0) {tally.reflected++; tally.eReflected += bank.E[i];}
+    }
+
+    // collision event: move to the site and choose the reaction, or continue after a virtual collision
+    compton.clear();
+    absorption.clear();
+    for (size_t k = 0; k < collision.size(); k++)
+    {
+      int i = collision[k];
+      bank.z[i] += dist[i] * bank.u[i];
+      if (cfg.delta)
+      {
+        bank.layer[i] = p.LayerAt(bank.z[i]);
+        double mut = p.lookup.EvalOne(bank.E[i], bank.layer[i]);
+        if (unif(rng) * bank.mut[i] >= mut) {dead[i] = 0; continue;}
+        bank.mut[i] = mut;
+      }
+      bank.collided[i] = 1;
+      double muc = p.ne[bank.layer[i]] * KleinNishinaTotal(bank.E[i]);
+      if (unif(rng) * bank.mut[i] < muc) compton.push_back(i); else absorption.push_back(i);
+    }
+
+    // photoabsorption event
+    for (size_t k = 0; k < absorption.size(); k++)
+    {
+      int i = absorption[k];
+      tally.edep.sum[bank.layer[i]] += bank.E[i];
+      if (bank.layer[i] == nLayers - 1) bank.deposit[i] += bank.E[i];
+      tally.absorbed++;
+      dead[i] = 1;
+    }
+
+    // Compton event
+    for (size_t k = 0; k < compton.size(); k++)
+    {
+      int i = compton[k];
+      double cosTheta, E1 = SampleCompton(bank.E[i], rng, cosTheta);
+      double lost = (E1 < cfg.Ecut) ? bank.E[i] : bank.E[i] - E1; // below the cutoff the photon is absorbed
+      tally.edep.sum[bank.layer[i]] += lost;
+      if (bank.layer[i] == nLayers - 1) bank.deposit[i] += lost;
+      bank.u[i] = RotateDirection(bank.u[i], cosTheta, rng);
+      bank.E[i] = E1;
+      dead[i] = 0;
+      if (E1 < cfg.Ecut) {tally.absorbed++; dead[i] = 1;}
+    }
+
+    // score the pulse heights of finished photons and compact the bank
+    for (size_t i = 0; i < live; i++) if (dead[i] && bank.deposit[i] > 0) tally.pulseHeight.Score(bank.deposit[i], 1);
+    size_t kept = 0;
+    for (size_t i = 0; i < live; i++) if (!dead[i]) {if (kept != i) bank.Move(i, kept); kept++;}
+    live = kept;
+  }
+}
+
+TransportTally RunTransport(const vector<Layer>& stack, const TransportConfig& cfg, double& seconds,
+                            function<void(const TransportTally&, long)> checkpoint = nullptr)
+{
+  /*******
+  * Run cfg.histories photons through stack and return the merged tallies; seconds receives the wall time
+  * checkpoint, if given, receives the merged tallies and the histories run so far every cfg.checkpoint batches
+  *******/
+
+  SlabProblem p(stack);
+  long nBatches = (cfg.histories + TRANSPORT_BATCH - 1) / TRANSPORT_BATCH;
+  long round = cfg.checkpoint > 0 ? cfg.checkpoint : TALLY_ROUND;
+  TransportTally total(stack.size(), cfg);
+
+  auto runBatch = [&](long b, TransportTally& tally)
+  {
+    long n = min(TRANSPORT_BATCH, cfg.histories - b * TRANSPORT_BATCH);
+    mt19937_64 rng(cfg.seed * 1000003ULL + b);
+    if (cfg.eventBased) RunEventBatch(p, cfg, n, rng, tally);
+    else RunHistoryBatch(p, cfg, n, rng, tally);
+  };
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (long b0 = 0; b0 < nBatches; b0 += round)
+  {
+    long nRound = min(round, nBatches - b0);
+    vector<TransportTally> tallies(nRound, TransportTally(stack.size(), cfg));
+    if (numWorkers > 0)
+    {
+      long size = ShardSize(nRound), nShards = (nRound + size - 1) / size;
+      RunSharded(nShards, [&](long s)
+      {
+        long k0 = s * size, n = min(size, nRound - k0);
+        ParallelFor(n, [&](int k) {runBatch(b0 + k0 + k, tallies[k0 + k]);});
+        string out;
+        for (long k = 0; k < n; k++) tallies[k0 + k].Pack(out);
+        return out;
+      },
+      [&](long s, const string& result)
+      {
+        const char* in = result.data();
+        for (long k = s * size; k < min(nRound, (s + 1) * size); k++) tallies[k].Unpack(in);
+      });
+    }
+    else ParallelFor(nRound, [&](int k) {runBatch(b0 + k, tallies[k]);});
+    for (long k = 0; k < nRound; k++) total.Add(tallies[k]);
+    if (checkpoint && cfg.checkpoint > 0) checkpoint(total, min(cfg.histories, (b0 + nRound) * TRANSPORT_BATCH));
+  }
+  seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  return total;
+}
+
+void WriteTallies(string fileName, const TransportTally& t, const vector<Layer>& stack, double E0, long histories)
+{
+  /*******
+  * Write the histograms of t per source photon, each bin as "lo hi value relerr" under a "# name" line
+  *******/
+
+  ofstream out(fileName);
+  if (!out.is_open()) {cout << "Error: Tally file not open" << endl; exit(EXIT_FAILURE);}
+  out << "# histories " << histories << ", batches " << t.edep.batches << endl;
+  out << "# energy deposited per layer (fraction of incident energy)" << endl;
+  for (size_t i = 0; i < stack.size(); i++)
+    out << i << " " << stack[i].absorber << " " << t.edep.sum[i] / (histories * E0) << " " << t.edep.RelError(i) << endl;
+  const Histogram* h[3] = {&t.spectrum, &t.exitCos, &t.pulseHeight};
+  const char* names[3] = {"transmitted spectrum (keV, photons per bin)", "exit direction cosine (photons per bin)",
+                          "pulse height in the last layer (keV, events per bin)"};
+  for (int k = 0; k < 3; k++)
+  {
+    out << "# " << names[k] << endl;
+    for (size_t i = 0; i < h[k]->sum.size(); i++)
+      out << h[k]->lo + i * h[k]->width << " " << h[k]->lo + (i + 1) * h[k]->width << " "
+          << h[k]->sum[i] / histories << " " << h[k]->RelError(i) << endl;
+  }
+}
@@ -0,0 +1,247 @@
+/*******
+* Unfold.hh
+*   Source-spectrum unfolding: the unshielded spectrum that, seen through the stack, gives a measured spectrum.
+*
+* Dependencies:
+*   CalcAtten.hh: Layer, SplitArgs() and numThreads
+*   Tables.hh: StackLookup
+*   Sweep.hh: SweepPointT()
+*
+* Measured spectrum file:
+*   one channel per line, "keV counts", in increasing energy; channel edges are halfway between centres, the
+*   outer ones as far out as the inner ones; empty lines and lines starting with '#' are skipped
+*
+* Forward model:
+*   the source is binned on the same channels; a photon of source bin j (at its centre E_j) gets through the
+*   stack with the narrow-beam transmission T(E_j), from the in-memory tables, and is recorded with a Gaussian
+*   of FWHM fwhm% of 662 keV at 662 keV, scaling as sqrt(E), integrated over each channel and cut at
+*   UNFOLD_GAUSS_CUTOFF sigmas; fwhm 0 records it in its own channel
+*   the response R is built once as sparse columns (for the adjoint product) and rows (for the forward one),
+*   so a fold is a sparse matrix-vector product of a few nonzeros per channel
+*
+* Method:
+*   MLEM (Richardson-Lucy), the maximum-likelihood estimate for Poisson counts, which keeps the source
+*   non-negative:  x_j <- x_j / s_j * sum_i R_ij m_i / (R x)_i,  with s_j = sum_i R_ij, from a flat start
+*   each iteration is one forward and one adjoint product; channels are split across Threads threads that
+*   stay up for the whole solve and meet at a barrier between the two products, as thousands of iterations
+*   would otherwise spend more time starting threads than folding
+*   source bins no channel can see (s_j = 0) are left at 0
+*
+* Output:
+*   "keV source fitted measured" per channel: the unfolded source counts, their fold and the measurement
+*
+* Ref:
+*   L. A. Shepp and Y. Vardi, "Maximum likelihood reconstruction for emission tomography", IEEE Trans. Med.
+*   Imaging 1 (1982) 113
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+const double UNFOLD_FWHM_KEV = 662.0; // energy at which the resolution is given
+const double UNFOLD_GAUSS_CUTOFF = 5.0;
+
+struct UnfoldResponse
+{
+  int n; // channels, and source bins
+  vector<double> E, lo, hi; // keV: channel centres and edges
+  vector<double> T; // transmission at each centre
+  vector<int> colStart, colFirst; // column j: rows colFirst[j] on, values colVal[colStart[j] .. colStart[j+1])
+  vector<double> colVal;
+  vector<int> rowStart, rowCol; // row i: entries rowStart[i] .. rowStart[i+1] of rowCol and rowVal
+  vector<double> rowVal;
+  vector<double> sensitivity; // column sums s_j
+};
+
+struct SpinBarrier
+{
+  /*******
+  * Barrier for the threads of one solve; the last to arrive starts the next phase
+  *******/
+
+  int n;
+  atomic<int> waiting, phase;
+
+  SpinBarrier(int nThreads) : n(nThreads), waiting(0), phase(0) {}
+
+  void Wait()
+  {
+    int p = phase.load();
+    if (waiting.fetch_add(1) + 1 == n) {waiting.store(0); phase.fetch_add(1); return;}
+    while (phase.load() == p) this_thread::yield();
+  }
+};
+
+void ReadMeasuredSpectrum(string fileName, vector<double>& E, vector<double>& counts)
+{
+  /*******
+  * Read "keV counts" lines; see the header of this file
+  *******/
+
+  ifstream in(fileName);
+  if (!in.is_open()) {cout << "Error: Measured spectrum not open" << endl; exit(EXIT_FAILURE);}
+  string line;
+  while (getline(in, line))
+  {
+    if (line.find_first_not_of(" \t\r") == string::npos || line[line.find_first_not_of(" \t")] == '#') continue;
+    istringstream iss(line);
+    double e, c;
+    if (!(iss >> e >> c) || e <= 0 || c < 0) {cout << "Error: Bad measured spectrum line: " << line << endl; exit(EXIT_FAILURE);}
+    if (!E.empty() && e <= E.back()) {cout << "Error: Measured spectrum energies must increase" << endl; exit(EXIT_FAILURE);}
+    E.push_back(e);
+    counts.push_back(c);
+  }
+  if (E.size() < 2) {cout << "Error: Measured spectrum needs at least 2 channels" << endl; exit(EXIT_FAILURE);}
+}
+
+UnfoldResponse BuildResponse(const vector<Layer>& stack, const vector<double>& E, double fwhmPercent)
+{
+  /*******
+  * Response of the stack and detector on the channels centred at E
+  *******/
+
+  UnfoldResponse r;
+  r.n = E.size();
+  r.E = E;
+  r.lo.resize(r.n);
+  r.hi.resize(r.n);
+  for (int i = 0; i < r.n; i++)
+  {
+    r.lo[i] = (i > 0) ? 0.5 * (E[i-1] + E[i]) : E[0] - 0.5 * (E[1] - E[0]);
+    r.hi[i] = (i < r.n - 1) ? 0.5 * (E[i] + E[i+1]) : E[i] + 0.5 * (E[i] - E[i-1]);
+  }
+
+  StackLookup lookup(stack);
+  vector<double> mu(stack.size());
+  r.T.resize(r.n);
+  for (int j = 0; j < r.n; j++) r.T[j] = SweepPointT(lookup, stack, E[j], mu);
+
+  // columns: the transmitted line of bin j spread over the channels within the cutoff
+  r.colStart.push_back(0);
+  for (int j = 0; j < r.n; j++)
+  {
+    double sigma = fwhmPercent / 100. * sqrt(UNFOLD_FWHM_KEV * E[j]) / (2. * sqrt(2. * log(2.)));
+    int first = j, last = j;
+    if (sigma > 0)
+    {
+      first = upper_bound(r.hi.begin(), r.hi.end(), E[j] - UNFOLD_GAUSS_CUTOFF * sigma) - r.hi.begin();
+      last = lower_bound(r.lo.begin(), r.lo.end(), E[j] + UNFOLD_GAUSS_CUTOFF * sigma) - r.lo.begin() - 1;
+    }
+    r.colFirst.push_back(first);
+    for (int i = first; i <= last; i++)
+    {
+      double p = (sigma > 0) ? 0.5 * (erf((r.hi[i] - E[j]) / (sqrt(2.) * sigma)) - erf((r.lo[i] - E[j]) / (sqrt(2.) * sigma))) : 1.0;
+      r.colVal.push_back(r.T[j] * p);
+    }
+    r.colStart.push_back(r.colVal.size());
+  }
+
+  // rows: the same entries by channel
+  vector<int> rowCount(r.n + 1, 0);
+  for (int j = 0; j < r.n; j++)
+    for (int k = r.colStart[j]; k < r.colStart[j+1]; k++) rowCount[r.colFirst[j] + k - r.colStart[j] + 1]++;
+  r.rowStart.assign(r.n + 1, 0);
+  for (int i = 0; i < r.n; i++) r.rowStart[i+1] = r.rowStart[i] + rowCount[i+1];
+  r.rowCol.resize(r.colVal.size());
+  r.rowVal.resize(r.colVal.size());
+  vector<int> fill(r.rowStart.begin(), r.rowStart.end() - 1);
+  r.sensitivity.assign(r.n, 0.0);
+  for (int j = 0; j < r.n; j++)
+    for (int k = r.colStart[j]; k < r.colStart[j+1]; k++)
+    {
+      int i = r.colFirst[j] + k - r.colStart[j];
+      r.rowCol[fill[i]] = j;
+      r.rowVal[fill[i]++] = r.colVal[k];
+      r.sensitivity[j] += r.colVal[k];
+    }
+  return r;
+}
+
+void Fold(const UnfoldResponse& r, const vector<double>& x, vector<double>& y, int i0, int i1)
+{
+  /*******
+  * y = R x on channels i0 .. i1-1
+  *******/
+
+  for (int i = i0; i < i1; i++)
+  {
+    double sum = 0.0;
+    for (int k = r.rowStart[i]; k < r.rowStart[i+1]; k++) sum += r.rowVal[k] * x[r.rowCol[k]];
+    y[i] = sum;
+  }
+}
+
+vector<double> MlemUnfold(const UnfoldResponse& r, const vector<double>& measured, int iterations)
+{
+  /*******
+  * Source estimate after the given number of MLEM iterations; see the header of this file
+  *******/
+
+  double total = 0.0, seen = 0.0;
+  for (int i = 0; i < r.n; i++) {total += measured[i]; seen += r.sensitivity[i];}
+  vector<double> x(r.n), y(r.n), ratio(r.n);
+  for (int j = 0; j < r.n; j++) x[j] = (r.sensitivity[j] > 0 && seen > 0) ? total / seen : 0.0;
+
+  int nThreads = numThreads > 0 ? numThreads : (int)thread::hardware_concurrency();
+  nThreads = max(1, min(nThreads, r.n / 64));
+  SpinBarrier barrier(nThreads);
+  auto solve = [&](int t)
+  {
+    int i0 = (long)r.n * t / nThreads, i1 = (long)r.n * (t + 1) / nThreads;
+    for (int it = 0; it < iterations; it++)
+    {
+      // forward: fold the estimate, compare with the measurement
+      Fold(r, x, y, i0, i1);
+      for (int i = i0; i < i1; i++) ratio[i] = (y[i] > 0) ? measured[i] / y[i] : 0.0;
+      if (nThreads > 1) barrier.Wait();
+
+      // adjoint: back-project the ratios
+      for (int j = i0; j < i1; j++)
+      {
+        if (r.sensitivity[j] <= 0) continue;
+        const double* v = &r.colVal[r.colStart[j]];
+        const double* q = &ratio[r.colFirst[j]];
+        double sum = 0.0;
+        for (int k = 0; k < r.colStart[j+1] - r.colStart[j]; k++) sum += v[k] * q[k];
+        x[j] *= sum / r.sensitivity[j];
+      }
+      if (nThreads > 1) barrier.Wait();
+    }
+  };
+  if (nThreads <= 1) {solve(0); return x;}
+  vector<thread> team;
+  for (int t = 0; t < nThreads; t++) team.push_back(thread(solve, t));
+  for (int t = 0; t < nThreads; t++) team[t].join();
+  return x;
+}
+
+void Unfold(const vector<Layer>& stack, string measuredFile, string outFile, double fwhmPercent, int iterations)
+{
+  /*******
+  * Unfold the source spectrum behind stack from measuredFile and write it to outFile
+  *******/
+
+  vector<double> E, measured;
+  ReadMeasuredSpectrum(measuredFile, E, measured);
+  UnfoldResponse r = BuildResponse(stack, E, fwhmPercent);
+  cout << "Unfolding " << r.n << " channels through " << stack.size() << " layers, " << r.colVal.size() << " response entries" << endl;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<double> x = MlemUnfold(r, measured, iterations);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  vector<double> y(r.n);
+  Fold(r, x, y, 0, r.n);
+
+  ofstream out(outFile);
+  if (!out.is_open()) {cout << "Error: Unfold output not open" << endl; exit(EXIT_FAILURE);}
+  out.precision(10);
+  double chi2 = 0.0, source = 0.0;
+  for (int i = 0; i < r.n; i++)
+  {
+    out << E[i] << " " << x[i] << " " << y[i] << " " << measured[i] << "\n";
+    chi2 += (y[i] - measured[i]) * (y[i] - measured[i]) / max(measured[i], 1.0);
+    source += x[i];
+  }
+  cout << "  " << iterations << " iterations in " << seconds << " s (" << 1e6 * seconds / max(iterations, 1) << " us each)" << endl;
+  cout << "  source total " << source << ", fit chi2/channel " << chi2 / r.n << endl;
+}
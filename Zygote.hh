@@ -0,0 +1,436 @@
+/*******
+* Zygote.hh
+*   Pre-warmed fork server: one-shot CLI runs become a fork of a process that has already read every material.
+*
+* Dependencies:
+*   CalcAtten.hh: DataFileAbsorbers(), LoadMaterial(), Density(), ReadDataFileMACs(), dataFileCache,
+*   materialCache and preloadedMaterials
+*   Shard.hh: SendAll(), WriteAll() and ReadAll()
+*   Snapshot.hh: RestoreSnapshot()
+*   Tables.hh: FreeTables()
+*
+* Use:
+*   start a server once, from the directory holding Data/:  ./CalcAtten --zygote /tmp/calcatten.sock &
+*   or from a snapshot, with its packed tables, without reading Data/:  ./CalcAtten --zygote /tmp/calcatten.sock warm.snap &
+*   then point unchanged scripts at it:                    export CALCATTEN_ZYGOTE=/tmp/calcatten.sock
+*   with CALCATTEN_ZYGOTE set, ./CalcAtten <args> is a thin client: it hands its working directory, arguments
+*   and standard input, output and error to the server, and exits with the status of the run; if nothing is
+*   listening on the socket it runs the macro itself, as before
+*
+* Method:
+*   the server parses every Data/ file ahead of time, both into preloadedMaterials and into dataFileCache, the
+*   exact values the Shield command's Density() and MassAttenCoeff() would read, so output is unchanged; a run
+*   moves a preloaded material into the material cache when it first loads it, so what it has loaded, and so
+*   what PackTables packs and Snapshot saves, is the same as in a direct run
+*   for every connection it forks a handler, which receives the request, with the client's file descriptors
+*   passed over the socket (SCM_RIGHTS), and forks the run: a copy of the warm server, with the client's
+*   descriptors as 0, 1 and 2, in the client's directory; the handler waits for it (the run holds one end of a
+*   pipe, which closes when it exits) and sends back its exit status, and kills it if the client goes away
+*   (e.g. on Ctrl-C)
+*   a client in another directory gets a run with the caches (and any packed tables) dropped, since its Data/
+*   files may differ
+*
+* Cost accounting:
+*   every run records a span per macro command (or per phase of a table or plan job): its start, duration and
+*   the WorkCounters it added (coefficients looked up, stack evaluations, cache hits and misses); when the run
+*   exits it sends these, with its totals and the bytes it wrote (/proc/self/io), up the pipe its handler waits
+*   on; work done in Workers processes is not counted
+*   the handler then writes one line per request to the server's output: the arguments, exit status, queue
+*   wait (client send to run start), compute time, total latency and the counts
+*   a request slower than CALCATTEN_SLOW seconds (default ZYGOTE_SLOW_SECONDS), as set when the server starts,
+*   also has its cost line and full span trace kept in a ring of SLOW_SLOTS slots in memory shared by all
+*   handlers, the oldest overwritten first; ./CalcAtten --slow-requests, with CALCATTEN_ZYGOTE set, prints it
+*
+* Protocol:
+*   client to server: ZygoteRequestHead (request length and send time), sent with the three descriptors, then
+*   the working directory and each argument, every one '\0'-terminated
+*   server to client: exit status (int)
+*
+* Author:
+*   Tom Gilliss (UNC, ENAP) 2018-07-09 for NCSSM project
+*******/
+
+#include <sys/un.h> // sockaddr_un for the server socket
+#include <sys/stat.h> // lstat() before replacing a stale socket
+#include <cstdlib> // getenv() for CALCATTEN_ZYGOTE
+#include <cerrno> // errno, to retry calls interrupted by a signal
+#include <new> // placement new of the shared slow-request ring
+
+const char* ZYGOTE_ENV = "CALCATTEN_ZYGOTE";
+const char* ZYGOTE_SLOW_ENV = "CALCATTEN_SLOW";
+const double ZYGOTE_SLOW_SECONDS = 1.0;
+const int SLOW_SLOTS = 64;
+const size_t SLOW_SLOT_BYTES = 1 << 15;
+
+struct ZygoteRequestHead
+{
+  long len; // bytes of the request that follows
+  double sent; // SteadySeconds() at the client
+};
+
+struct TraceSpan
+{
+  int line; // macro line, 0 for a job phase
+  string what;
+  double start, seconds; // from the start of the run; seconds < 0 while open
+  WorkCounters work;
+};
+
+struct RequestReport
+{
+  double start, seconds; // run start (SteadySeconds()) and duration
+  WorkCounters work;
+  long bytesOut;
+  long traceBytes; // span lines that follow
+};
+
+struct SlowSlot
+{
+  atomic<long> seq; // request number + 1 once written, 0 while being written
+  long len;
+  char text[SLOW_SLOT_BYTES - 2 * sizeof(long)];
+};
+
+struct SlowRing
+{
+  atomic<long> next; // requests recorded so far
+  SlowSlot slots[SLOW_SLOTS];
+};
+
+bool traceRequest = false; // this process is a zygote run: record spans and report them at exit
+vector<TraceSpan> traceSpans;
+double traceStart = 0.0;
+int traceFd = -1;
+pid_t tracePid = 0;
+SlowRing* slowRing = NULL;
+double slowSeconds = ZYGOTE_SLOW_SECONDS;
+
+double SteadySeconds()
+{
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void OpenSpan(int line, string what)
+{
+  /*******
+  * Start a span of the run's trace, ending the one before; a no-op outside a zygote run
+  *******/
+
+  if (!traceRequest) return;
+  double now = SteadySeconds() - traceStart;
+  if (!traceSpans.empty() && traceSpans.back().seconds < 0)
+    {traceSpans.back().seconds = now - traceSpans.back().start; traceSpans.back().work = workCounters - traceSpans.back().work;}
+  if (line >= 0) traceSpans.push_back(TraceSpan{line, what, now, -1.0, workCounters});
+}
+
+void CloseSpan()
+{
+  OpenSpan(-1, "");
+}
+
+string FormatWork(const WorkCounters& w)
+{
+  char buf[160];
+  snprintf(buf, sizeof(buf), "layers=%ld energies=%ld cache=%ld/%ld", w.layers, w.energies, w.cacheHits, w.cacheHits + w.cacheMisses);
+  return buf;
+}
+
+void ReportRequest()
+{
+  /*******
+  * atexit() handler of a zygote run: send its report to the handler
+  *******/
+
+  if (!traceRequest || getpid() != tracePid) return;
+  CloseSpan();
+  cout.flush();
+  RequestReport r;
+  r.start = traceStart;
+  r.seconds = SteadySeconds() - traceStart;
+  r.work = workCounters;
+  r.bytesOut = 0;
+  ifstream io("/proc/self/io");
+  string key;
+  long value;
+  while (io >> key >> value) if (key == "wchar:") r.bytesOut = value;
+  string text;
+  char buf[128];
+  for (size_t s = 0; s < traceSpans.size(); s++)
+  {
+    const TraceSpan& t = traceSpans[s];
+    text.append(buf, snprintf(buf, sizeof(buf), t.line > 0 ? "  line %d " : "  ", t.line));
+    text += t.what;
+    text.append(buf, snprintf(buf, sizeof(buf), " at +%.6f s for %.6f s, ", t.start, t.seconds));
+    text += FormatWork(t.work) + "\n";
+  }
+  r.traceBytes = text.size();
+  WriteAll(traceFd, &r, sizeof(r));
+  WriteAll(traceFd, text.data(), text.size());
+}
+
+void RecordSlowRequest(const string& text)
+{
+  /*******
+  * Keep text in the next slot of the shared ring
+  *******/
+
+  long ticket = slowRing->next.fetch_add(1);
+  SlowSlot& slot = slowRing->slots[ticket % SLOW_SLOTS];
+  slot.seq.store(0);
+  slot.len = min(text.size(), sizeof(slot.text));
+  memcpy(slot.text, text.data(), slot.len);
+  slot.seq.store(ticket + 1);
+}
+
+string DumpSlowRequests()
+{
+  /*******
+  * The slow requests in the ring, oldest first
+  *******/
+
+  vector<pair<long, string> > kept;
+  for (int i = 0; i < SLOW_SLOTS; i++)
+  {
+    SlowSlot& slot = slowRing->slots[i];
+    long seq = slot.seq.load();
+    if (seq <= 0) continue;
+    string text(slot.text, min((size_t)slot.len, sizeof(slot.text)));
+    if (slot.seq.load() == seq) kept.push_back(make_pair(seq, text));
+  }
+  sort(kept.begin(), kept.end());
+  char buf[128];
+  string out(buf, snprintf(buf, sizeof(buf), "%ld slow requests (over %g s) since start, the last %zu kept:\n",
+                           slowRing->next.load(), slowSeconds, kept.size()));
+  for (size_t k = 0; k < kept.size(); k++) out += kept[k].second;
+  return out;
+}
+
+void AccountRequest(const ZygoteRequestHead& head, const vector<char*>& args, int status, const string& report)
+{
+  /*******
+  * Log the cost of a finished request, and keep its trace if it was slow
+  *******/
+
+  double total = SteadySeconds() - head.sent;
+  string line = "request";
+  for (size_t a = 2; a < args.size(); a++) line += string(" ") + args[a];
+  char buf[160];
+  line.append(buf, snprintf(buf, sizeof(buf), ": status %d, total %.6f s", status, total));
+  RequestReport r;
+  if (report.size() >= sizeof(r))
+  {
+    memcpy(&r, report.data(), sizeof(r));
+    line.append(buf, snprintf(buf, sizeof(buf), ", wait %.6f s, compute %.6f s, ", r.start - head.sent, r.seconds));
+    line += FormatWork(r.work);
+    line.append(buf, snprintf(buf, sizeof(buf), " out=%ld bytes", r.bytesOut));
+  }
+  else line += ", no report";
+  line += "\n";
+  WriteAll(1, line.data(), line.size());
+  if (total >= slowSeconds && slowRing) RecordSlowRequest(line + (report.size() > sizeof(r) ? report.substr(sizeof(r)) : ""));
+}
+
+bool ZygoteAddress(string path, sockaddr_un& addr)
+{
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) return false;
+  strcpy(addr.sun_path, path.c_str());
+  return true;
+}
+
+bool RunInZygote(int argc, char* argv[], int& status)
+{
+  /*******
+  * Run this invocation in the zygote named by CALCATTEN_ZYGOTE; false if there is none to run it
+  *******/
+
+  const char* path = getenv(ZYGOTE_ENV);
+  sockaddr_un addr;
+  if (!path || !*path || !ZygoteAddress(path, addr)) return false;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return false;
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {close(fd); return false;}
+
+  // the request: working directory and arguments
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd))) {close(fd); return false;}
+  string request(cwd, strlen(cwd) + 1);
+  for (int i = 0; i < argc; i++) request.append(argv[i], strlen(argv[i]) + 1);
+
+  // its length and send time, carrying the standard descriptors
+  ZygoteRequestHead head = {(long)request.size(), SteadySeconds()};
+  iovec iov = {&head, sizeof(head)};
+  int fds[3] = {0, 1, 2};
+  char control[CMSG_SPACE(sizeof(fds))];
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(head) || !SendAll(fd, request.data(), head.len)) {close(fd); return false;}
+
+  // the run now owns our output; wait for its status
+  if (!ReadAll(fd, &status, sizeof(status))) status = EXIT_FAILURE;
+  close(fd);
+  return true;
+}
+
+void ServeRequest(int conn, function<int(int, char**)> run, string home)
+{
+  /*******
+  * Handler for one connection: receive the request, fork the run, report its exit status, account for it
+  *******/
+
+  ZygoteRequestHead head;
+  int fds[3];
+  iovec iov = {&head, sizeof(head)};
+  char control[CMSG_SPACE(sizeof(fds))];
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if (recvmsg(conn, &msg, 0) != sizeof(head)) _exit(1);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) _exit(1);
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  if (head.len <= 0 || head.len > (1L << 24)) _exit(1);
+  string request(head.len, '\0');
+  if (!ReadAll(conn, &request[0], head.len)) _exit(1);
+  vector<char*> args;
+  for (size_t p = 0; p < request.size(); p += strlen(&request[p]) + 1) args.push_back(&request[p]);
+  if (args.size() < 2) _exit(1);
+
+  // a request for the slow-request ring is answered here
+  if (args.size() == 3 && string(args[2]) == "--slow-requests")
+  {
+    string dump = DumpSlowRequests();
+    int status = WriteAll(fds[1], dump.data(), dump.size()) ? 0 : 1;
+    SendAll(conn, &status, sizeof(status));
+    _exit(0);
+  }
+
+  // the run holds the write end of done, which closes when it exits
+  int done[2];
+  if (pipe(done) != 0) _exit(1);
+  pid_t pid = fork();
+  if (pid < 0) _exit(1);
+  if (pid == 0)
+  {
+    for (int i = 0; i < 3; i++) {dup2(fds[i], i); close(fds[i]);}
+    close(conn);
+    close(done[0]);
+    traceRequest = true;
+    traceStart = SteadySeconds();
+    workCounters = WorkCounters{0, 0, 0, 0}; // not the server's preloading
+    traceFd = done[1];
+    tracePid = getpid();
+    atexit(ReportRequest);
+    signal(SIGPIPE, SIG_DFL);
+    if (chdir(args[0]) != 0) {cout << "Error: Could not change to " << args[0] << endl; exit(EXIT_FAILURE);}
+    if (home != args[0]) {materialCache.clear(); preloadedMaterials.clear(); dataFileCache.clear(); FreeTables();}
+    exit(run(args.size() - 1, &args[1]));
+  }
+  for (int i = 0; i < 3; i++) close(fds[i]);
+  close(done[1]);
+
+  // wait for the run, watching for the client hanging up; the run sends its report just before it exits
+  // if the wait itself fails, the run is killed and the client told it failed
+  pollfd pfds[2] = {{done[0], POLLIN, 0}, {conn, POLLIN, 0}};
+  int ready;
+  while ((ready = poll(pfds, 2, -1)) < 0 && errno == EINTR) {}
+  int wstatus = 0;
+  if (ready < 0 || (pfds[1].revents && !pfds[0].revents))
+  {
+    int status = 128 + SIGKILL;
+    kill(pid, SIGKILL);
+    waitpid(pid, &wstatus, 0);
+    if (ready < 0) SendAll(conn, &status, sizeof(status));
+    AccountRequest(head, args, status, "");
+    _exit(0);
+  }
+  string report;
+  char chunk[4096];
+  for (ssize_t k; (k = read(done[0], chunk, sizeof(chunk))) != 0; ) if (k > 0) report.append(chunk, k); else if (errno != EINTR) break;
+  waitpid(pid, &wstatus, 0);
+  int status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+  SendAll(conn, &status, sizeof(status));
+  AccountRequest(head, args, status, report);
+  _exit(0);
+}
+
+void ServeZygote(string path, function<int(int, char**)> run, string snapshot)
+{
+  /*******
+  * Preload every material in Data/, or restore a snapshot if one is given, and serve runs on the Unix socket at
+  * path until killed
+  *******/
+
+  // read the Data/ files now, in every form a macro could ask for them, unless a snapshot holds them already
+  vector<string> absorbers;
+  if (!snapshot.empty()) RestoreSnapshot(snapshot);
+  else
+  {
+    absorbers = DataFileAbsorbers();
+    if (absorbers.empty()) {cout << "Error: No Data/ files to preload" << endl; exit(EXIT_FAILURE);}
+  }
+  for (size_t i = 0; i < absorbers.size(); i++)
+  {
+    LoadMaterial(absorbers[i]);
+    DataFileTable t;
+    t.density = Density(absorbers[i]);
+    ReadDataFileMACs(absorbers[i], t.Es, t.MACs);
+    dataFileCache[absorbers[i]] = t;
+  }
+  if (snapshot.empty()) preloadedMaterials.swap(materialCache); // a snapshot's materials stay loaded, with its tables
+
+  sockaddr_un addr;
+  if (!ZygoteAddress(path, addr)) {cout << "Error: Zygote socket path too long" << endl; exit(EXIT_FAILURE);}
+  // a socket left by an earlier server is replaced; anything else at the path is not ours to delete
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0)
+  {
+    if (!S_ISSOCK(st.st_mode)) {cout << "Error: " << path << " exists and is not a socket" << endl; exit(EXIT_FAILURE);}
+    unlink(path.c_str());
+  }
+  int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (lfd < 0 || bind(lfd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 128) != 0)
+    {cout << "Error: Could not listen on " << path << endl; exit(EXIT_FAILURE);}
+  char cwd[4096];
+  string home = getcwd(cwd, sizeof(cwd)) ? cwd : "";
+
+  // the slow-request ring, shared by every handler
+  const char* slow = getenv(ZYGOTE_SLOW_ENV);
+  if (slow && *slow) slowSeconds = stod(slow);
+  void* ring = mmap(NULL, sizeof(SlowRing), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {cout << "Error: Could not allocate the slow-request ring" << endl; exit(EXIT_FAILURE);}
+  slowRing = new (ring) SlowRing();
+  cout << "Zygote ready on " << path << " with " << materialCache.size() + preloadedMaterials.size() << " materials preloaded, tracing requests over "
+       << slowSeconds << " s" << endl;
+
+  // handlers are reaped automatically; each restores SIGCHLD so it can wait for its run
+  signal(SIGCHLD, SIG_IGN);
+  signal(SIGPIPE, SIG_IGN);
+  while (true)
+  {
+    int conn = accept(lfd, NULL, NULL);
+    if (conn < 0) continue;
+    cout.flush();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(lfd);
+      signal(SIGCHLD, SIG_DFL);
+      ServeRequest(conn, run, home);
+    }
+    close(conn);
+  }
+}